@@ -67,6 +67,12 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/*
+ * The reverse: the physical address behind a kseg0 kernel virtual
+ * address, such as one returned by alloc_kpages().
+ */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -106,14 +112,13 @@ void ram_getsize(paddr_t *lo, paddr_t *hi);
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
+ *
+ * Shootdowns are by physical frame: the other CPUs drop whatever
+ * entries map it, in any address space.
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	struct addrspace *ts_addrspace;
-	vaddr_t ts_vaddr;
+	paddr_t ts_paddr;
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -37,6 +37,7 @@
 #include <syscall.h>
 #include <machine/trapframe.h>
 #include "opt-A2.h"
+#include "opt-dumbvm.h"
 #include <addrspace.h>
 
 
@@ -151,6 +152,44 @@ syscall(struct trapframe *tf)
 
 #endif // UW
 
+#if !OPT_DUMBVM
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_mmap:
+		err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			       (int)tf->tf_a2, (int)tf->tf_a3, &retval);
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+	    case SYS_shmget:
+		err = sys_shmget((key_t)tf->tf_a0, (size_t)tf->tf_a1,
+				 (int)tf->tf_a2, &retval);
+		break;
+
+	    case SYS_shmat:
+		err = sys_shmat((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+				(int)tf->tf_a2, &retval);
+		break;
+
+	    case SYS_shmdt:
+		err = sys_shmdt((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_shmctl:
+		err = sys_shmctl((int)tf->tf_a0, (int)tf->tf_a1,
+				 (userptr_t)tf->tf_a2);
+		break;
+
+	    case SYS_getrusage:
+		err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+#endif
+
 	    /* Add stuff here */
  
 	default:
@@ -0,0 +1,321 @@
+/*
+ * MIPS TLB management for the VM system.
+ *
+ * These wrap the raw tlb_* accessors in tlb-mips1.S. Each runs with
+ * interrupts off on the current CPU, since the TLB is per-CPU state
+ * and an interrupt in the middle could context switch and reload it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <uw-vmstats.h>
+
+/*
+ * The current ASID lives in the PID field of c0_entryhi, which the
+ * processor matches against each TLB entry. tlb_read and tlb_write
+ * (and so also the TLBHI_INVALID entries) overwrite entryhi, so
+ * everything here that uses them puts the ASID back afterwards.
+ */
+#define GET_ENTRYHI(x) __asm volatile("mfc0 %0,$10" : "=r" (x))
+#define SET_ENTRYHI(x) __asm volatile("mtc0 %0,$10" :: "r" (x))
+
+static
+uint32_t
+tlb_getasid(void)
+{
+	uint32_t ehi;
+
+	GET_ENTRYHI(ehi);
+	return ehi & TLBHI_PID;
+}
+
+static
+void
+tlb_setasid(uint32_t asid)
+{
+	SET_ENTRYHI(asid & TLBHI_PID);
+}
+
+/*
+ * Address space IDs.
+ *
+ * ASIDs are handed out from one global pool in increasing order, so
+ * every address space that has run since the last rollover has its
+ * own and its TLB entries can stay put across context switches. When
+ * the pool runs out a new generation starts and numbering begins
+ * again; an address space holding an ASID from an old generation
+ * gets a new one the next time it is activated, and each CPU flushes
+ * its TLB the first time it activates anything in the new generation.
+ * That flush is the only one; as_activate otherwise leaves the TLB
+ * alone.
+ *
+ * as_asid holds the generation number above the ASID bits. ASID 0 is
+ * never handed out, and generations start at 1, so a fresh address
+ * space (as_asid 0) always gets a new one.
+ *
+ * An address space that shows up on a different CPU from last time
+ * also gets a new ASID, because while it was away its mappings may
+ * have changed without the old CPU's TLB hearing about it. Retiring
+ * the ASID makes any entries left there unreachable.
+ */
+#define ASID_BITS	6
+#define ASID_COUNT	(1 << ASID_BITS)
+#define ASID_NUM(a)	((a) & (ASID_COUNT - 1))
+#define ASID_GEN(a)	((a) >> ASID_BITS)
+
+static unsigned asid_generation = 1;
+static unsigned asid_next = 1;
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+
+/* The generation each CPU's TLB was last flushed for */
+static unsigned tlb_generation[MAXCPUS];
+
+/*
+ * Per-CPU slot bookkeeping, indexed by cpu number.
+ *
+ * After a flush every slot is free, and tlb_insert fills them in
+ * order; slots from tlb_fill[] up are known to be empty. Once they
+ * are all used, slots are replaced round-robin starting from
+ * tlb_victim[]. Neither needs scanning the TLB, which costs a
+ * tlb_read per slot.
+ *
+ * Slots emptied by tlb_invalidate are not tracked; they get reused
+ * when the round-robin pointer comes around to them.
+ */
+static unsigned tlb_fill[MAXCPUS];
+static unsigned tlb_victim[MAXCPUS];
+
+/*
+ * Invalidate every entry in this CPU's TLB.
+ */
+void
+tlb_flush(void)
+{
+	uint32_t asid;
+	int i, spl;
+
+	spl = splhigh();
+	asid = tlb_getasid();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(asid);
+	tlb_fill[curcpu->c_number] = 0;
+	splx(spl);
+
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+/*
+ * Make AS's ASID current on this CPU, assigning a new one if needed.
+ */
+void
+tlb_activate(struct addrspace *as)
+{
+	unsigned cpunum, gen;
+	int spl;
+
+	spl = splhigh();
+	cpunum = curcpu->c_number;
+
+	spinlock_acquire(&asid_lock);
+	if (ASID_GEN(as->as_asid) != asid_generation ||
+	    as->as_asidcpu != cpunum) {
+		if (asid_next == ASID_COUNT) {
+			asid_generation++;
+			asid_next = 1;
+		}
+		as->as_asid = (asid_generation << ASID_BITS) | asid_next++;
+		as->as_asidcpu = cpunum;
+	}
+	gen = asid_generation;
+	spinlock_release(&asid_lock);
+
+	tlb_setasid(ASID_NUM(as->as_asid) << TLBHI_PIDSHIFT);
+
+	/* Stay at splhigh: nothing may use the TLB before the flush. */
+	if (tlb_generation[cpunum] != gen) {
+		tlb_generation[cpunum] = gen;
+		tlb_flush();
+	}
+	splx(spl);
+}
+
+/*
+ * Make every TLB entry for AS, on any CPU, unreachable, by retiring
+ * its ASID. If AS is current on this CPU, switch to a new one.
+ */
+void
+tlb_forget(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	spinlock_acquire(&asid_lock);
+	as->as_asid = 0;
+	spinlock_release(&asid_lock);
+
+	if (as == curproc_getas()) {
+		tlb_activate(as);
+	}
+	splx(spl);
+}
+
+/* Results of tlb_place */
+#define TLB_PLACED_EXISTING	0	/* overwrote the entry for the page */
+#define TLB_PLACED_FREE		1	/* used an empty slot */
+#define TLB_PLACED_REPLACE	2	/* replaced another valid entry */
+
+/*
+ * Load a translation for VADDR -> PADDR in the current address space
+ * into this CPU's TLB. If there is already an entry for VADDR it is
+ * overwritten (never write two entries with the same virtual page),
+ * unless KEEP is set, in which case it is left alone; otherwise an
+ * empty slot is used if one is known, or else the next round-robin
+ * victim. Returns which of these happened.
+ */
+static
+int
+tlb_place(vaddr_t vaddr, paddr_t paddr, bool writable, bool keep)
+{
+	uint32_t ehi, elo, oehi, oelo;
+	unsigned cpunum;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	elo = paddr | TLBLO_VALID;
+	if (writable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	spl = splhigh();
+	cpunum = curcpu->c_number;
+	ehi = vaddr | tlb_getasid();
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		if (!keep) {
+			tlb_write(ehi, elo, i);
+		}
+		splx(spl);
+		return TLB_PLACED_EXISTING;
+	}
+
+	if (tlb_fill[cpunum] < NUM_TLB) {
+		tlb_write(ehi, elo, tlb_fill[cpunum]++);
+		splx(spl);
+		return TLB_PLACED_FREE;
+	}
+
+	i = tlb_victim[cpunum];
+	tlb_victim[cpunum] = (i + 1) % NUM_TLB;
+	tlb_read(&oehi, &oelo, i);
+	tlb_write(ehi, elo, i);
+	splx(spl);
+
+	return (oelo & TLBLO_VALID) ? TLB_PLACED_REPLACE : TLB_PLACED_FREE;
+}
+
+void
+tlb_insert(vaddr_t vaddr, paddr_t paddr, bool writable)
+{
+	switch (tlb_place(vaddr, paddr, writable, false)) {
+	    case TLB_PLACED_FREE:
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		break;
+	    case TLB_PLACED_REPLACE:
+		vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+		break;
+	}
+}
+
+/*
+ * Like tlb_insert, but for a page nobody has asked for yet: an entry
+ * already there is kept, and it isn't counted as a TLB fault. Returns
+ * whether a new entry was loaded.
+ */
+bool
+tlb_preload(vaddr_t vaddr, paddr_t paddr, bool writable)
+{
+	return tlb_place(vaddr, paddr, writable, true) != TLB_PLACED_EXISTING;
+}
+
+/*
+ * Drop any entry for VADDR in the current address space from this
+ * CPU's TLB.
+ */
+void
+tlb_invalidate(vaddr_t vaddr)
+{
+	uint32_t asid;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spl = splhigh();
+	asid = tlb_getasid();
+	i = tlb_probe(vaddr | asid, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(asid);
+	splx(spl);
+}
+
+/*
+ * Drop any entries in this CPU's TLB that map to the frame PADDR.
+ * This is for when a frame is taken away from the page in it, and
+ * works without knowing which address space(s) mapped it where.
+ */
+void
+tlb_invalidate_paddr(paddr_t paddr)
+{
+	uint32_t ehi, elo, asid;
+	int i, spl;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spl = splhigh();
+	asid = tlb_getasid();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) && (elo & TLBLO_PPAGE) == paddr) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	tlb_setasid(asid);
+	splx(spl);
+}
+
+/*
+ * Drop any entries that map to the frame PADDR from every CPU's TLB,
+ * and wait until the other CPUs have done so, after which the frame
+ * can be reused. Interrupts stay off throughout so we can't move to
+ * another CPU partway.
+ */
+void
+tlb_shootdown_paddr(paddr_t paddr)
+{
+	struct tlbshootdown ts;
+	int spl;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	ts.ts_paddr = paddr;
+
+	spl = splhigh();
+	tlb_invalidate_paddr(paddr);
+	ipi_tlbshootdown_broadcast(&ts);
+	splx(spl);
+}
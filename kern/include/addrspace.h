@@ -36,8 +36,57 @@
 
 
 #include <vm.h>
+#include "opt-dumbvm.h"
 
 struct vnode;
+#if !OPT_DUMBVM
+#include <array.h>
+#include <spinlock.h>
+
+struct pagetable;
+struct shmseg;
+struct wchan;
+
+/*
+ * A region of the address space: rg_npages pages from rg_vbase up,
+ * with the access the program asked for. Part of it may be backed by
+ * a file (an ELF segment's initialized data): the rg_filesz bytes
+ * starting at user address rg_filevaddr come from rg_vnode at
+ * rg_fileoffset, and are read in when first touched. All other bytes
+ * of the region start out zero.
+ *
+ * Regions don't overlap, except that consecutive ELF segments may
+ * share the page where one ends and the next begins.
+ *
+ * In a shared region (MAP_SHARED), all address spaces mapping a page
+ * see the same copy, both across fork and, for files, between
+ * unrelated mappings of the same file; changes to a file's pages are
+ * written back to it when they're unmapped. A shared memory segment
+ * (shm.h) is mapped as a shared region with rg_shm set; its pages
+ * are all in the page table from the time it's attached.
+ */
+struct region {
+  vaddr_t rg_vbase;
+  size_t rg_npages;
+  bool rg_readable;
+  bool rg_writeable;
+  bool rg_executable;
+  bool rg_mmap;			/* made by mmap, so munmap may remove it */
+  bool rg_shared;		/* MAP_SHARED: never copied on write */
+  struct vnode *rg_vnode;	/* NULL if not file-backed */
+  struct shmseg *rg_shm;	/* shared memory segment, or NULL */
+  vaddr_t rg_filevaddr;
+  off_t rg_fileoffset;
+  size_t rg_filesz;
+};
+
+#ifndef REGIONINLINE
+#define REGIONINLINE INLINE
+#endif
+
+DECLARRAY(region);
+DEFARRAY(region, REGIONINLINE);
+#endif
 
 
 /* 
@@ -48,6 +97,7 @@ struct vnode;
  */
 
 struct addrspace {
+#if OPT_DUMBVM
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
   size_t as_npages1;
@@ -55,8 +105,80 @@ struct addrspace {
   paddr_t as_pbase2;
   size_t as_npages2;
   paddr_t as_stackpbase;
+#else
+  /*
+   * The segments loaded from the executable, and the stack. These
+   * only say which addresses are valid and where their contents come
+   * from; pages are created in the page table the first time each
+   * one is touched.
+   *
+   * The stack is a region ending at USERSTACK that starts out one
+   * page long and grows down when the program faults just below it,
+   * up to as_stacklimit pages. It never grows to within VM_STACKGUARD
+   * pages of the region below it, so running off the end of the stack
+   * faults instead of scribbling on the heap or data.
+   */
+  struct regionarray as_regions;	/* sorted by rg_vbase */
+  struct region *as_stack;		/* NULL until as_define_stack */
+  size_t as_stacklimit;			/* in pages */
+
+  /*
+   * The heap is a region starting on the page after the last ELF
+   * segment, moved by sbrk. It covers the pages up to and including
+   * the one holding the byte before the break, as_heapbrk, so it may
+   * be zero pages long.
+   */
+  struct region *as_heap;		/* NULL until as_complete_load */
+  vaddr_t as_heapbrk;
+  struct pagetable *as_pt;
+
+  /*
+   * The page merging thread (pagemerge.h) changes other processes'
+   * page tables, so the regions and page table of an address space
+   * it can see are only looked at or changed with as_lock held:
+   * as_copy, as_sbrk, as_mmap and as_munmap hold it. Before
+   * as_define_stack, or as_copy has returned, the merger doesn't
+   * know about the address space yet.
+   *
+   * vm_fault is too hot to take a sleep lock every time. User
+   * processes have one thread, so only the merger can be in the
+   * address space alongside a fault. They meet at a gate instead
+   * (as_faultbegin, as_scanbegin): a fault that finds no scan going
+   * just counts itself in as_nfaults and goes ahead without as_lock,
+   * and a scan, once it has as_lock, waits for those to finish.
+   * Faults that find a scan going take as_lock. as_gatelock
+   * protects as_nfaults and as_scanning.
+   */
+  struct lock *as_lock;
+  bool as_merging;		/* registered with the merger */
+  struct spinlock as_gatelock;
+  struct wchan *as_gatewchan;	/* for the scan to wait on */
+  unsigned as_nfaults;		/* faults going without as_lock */
+  bool as_scanning;		/* the merger is in, or waiting */
+
+  /*
+   * Pages the last fault-around (vm.h) loaded TLB entries for that
+   * haven't been faulted on since: bit i is the page i pages past
+   * as_fabase. A fault on one means the entry went unused. Only the
+   * process's own faults use these.
+   */
+  vaddr_t as_fabase;
+  uint32_t as_faloaded;
+
+  /* TLB address space ID; managed by the machine-dependent TLB code */
+  unsigned as_asid;
+  unsigned as_asidcpu;
+#endif
 };
 
+#if !OPT_DUMBVM
+/* Default limit on the size of the user stack, in pages (2M) */
+#define VM_STACKPAGES    512
+
+/* Unmapped pages always kept below the stack */
+#define VM_STACKGUARD    16
+#endif
+
 /*
  * Functions in addrspace.c:
  *
@@ -91,6 +213,80 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_file - make part of a region defined with
+ *                as_define_region read its contents from a file on
+ *                first touch, instead of starting out zero. The
+ *                address space keeps its own reference to the file.
+ *                (Not for dumbvm.)
+ *
+ *    as_findregion - return the region containing a user address, or
+ *                NULL if there isn't one. For a page shared by two
+ *                regions, this is the later one. Takes O(log n) in
+ *                the number of regions. (Not for dumbvm.)
+ *
+ *    as_readpage - fill in the parts of a new, zeroed page that come
+ *                from a file. (Not for dumbvm.)
+ *
+ *    as_pageaccess - report whether the program may touch and write
+ *                the page at a user address, and whether it's in a
+ *                shared region. (Not for dumbvm.)
+ *
+ *    as_cachekey - check whether the page at a user address is a page
+ *                of a file that can be shared with other processes
+ *                through the text cache (read-only, or MAP_SHARED),
+ *                and if so return the file and the piece of it the
+ *                page holds. (Not for dumbvm.)
+ *
+ *    as_valid_addr - check whether a user address falls within one of
+ *                the regions of the address space. (Not for dumbvm.)
+ *
+ *    as_growstack - extend the stack down to cover a user address
+ *                below it, if the stack's limit and guard gap allow.
+ *                Returns EFAULT if not. Called from vm_fault between
+ *                as_faultbegin and as_faultend. (Not for dumbvm.)
+ *
+ *    as_sbrk   - move the heap's break by AMOUNT bytes and hand back
+ *                the old break. Pages given up by shrinking the heap
+ *                are freed. (Not for dumbvm.)
+ *
+ *    as_mmap   - add a region of LEN bytes mapping vnode V from
+ *                OFFSET, or zero-filled memory if V is NULL, with the
+ *                PROT_* and MAP_* flags in <kern/mman.h>, and return
+ *                its address. With MAP_FIXED, that is the address
+ *                passed in. (Not for dumbvm.)
+ *
+ *    as_munmap - remove all or part of one region made by as_mmap,
+ *                first writing changed pages of a shared file mapping
+ *                back to the file. (Not for dumbvm.)
+ *
+ *    as_shmat  - map the shared memory segment SEG, which the caller
+ *                has counted an attachment to, at ADDR, or wherever
+ *                there's room if ADDR is 0; writable unless READONLY.
+ *                Hands back the address. On success the attachment
+ *                belongs to the address space. (Not for dumbvm.)
+ *
+ *    as_shmdt  - unmap the shared memory segment mapped at ADDR, and
+ *                drop the attachment. (Not for dumbvm.)
+ *
+ *    as_residentpages - count the pages mapped in the address space
+ *                that are in memory, including shared ones. Takes time
+ *                in proportion to the pages mapped. Called with
+ *                as_lock held, or between as_faultbegin and
+ *                as_faultend. (Not for dumbvm.)
+ *
+ *    as_faultbegin - keep the merger out of the address space while
+ *                vm_fault handles a fault in it. Returns true if that
+ *                took as_lock. (Not for dumbvm.)
+ *
+ *    as_faultend - let the merger in again; LOCKED is what
+ *                as_faultbegin returned. (Not for dumbvm.)
+ *
+ *    as_scanbegin - for the merger: take as_lock, and wait for faults
+ *                that went ahead without it. (Not for dumbvm.)
+ *
+ *    as_scanend - for the merger: release what as_scanbegin got.
+ *                (Not for dumbvm.)
  */
 
 struct addrspace *as_create(void);
@@ -107,6 +303,36 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+int               as_define_file(struct addrspace *as,
+                                 vaddr_t vaddr, size_t filesz,
+                                 struct vnode *v, off_t offset);
+struct region    *as_findregion(struct addrspace *as, vaddr_t vaddr);
+int               as_readpage(struct addrspace *as, vaddr_t vaddr,
+                              paddr_t paddr, bool *fromfile);
+void              as_pageaccess(struct addrspace *as, vaddr_t vaddr,
+                                bool *canread, bool *canwrite,
+                                bool *shared);
+bool              as_cachekey(struct addrspace *as, vaddr_t vaddr,
+                              struct vnode **v, off_t *offset,
+                              size_t *len);
+bool              as_valid_addr(struct addrspace *as, vaddr_t vaddr);
+int               as_growstack(struct addrspace *as, vaddr_t vaddr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbrk);
+int               as_mmap(struct addrspace *as, size_t len, int prot,
+                          int flags, struct vnode *v, off_t offset,
+                          vaddr_t *addr);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_shmat(struct addrspace *as, struct shmseg *seg,
+                           bool readonly, vaddr_t *addr);
+int               as_shmdt(struct addrspace *as, vaddr_t addr);
+unsigned          as_residentpages(struct addrspace *as);
+bool              as_faultbegin(struct addrspace *as);
+void              as_faultend(struct addrspace *as, bool locked);
+void              as_scanbegin(struct addrspace *as);
+void              as_scanend(struct addrspace *as);
+#endif
 
 
 /*
@@ -0,0 +1,81 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page allocator ("coremap").
+ *
+ * The coremap keeps one entry for every physical page frame that
+ * ram_getsize() hands to the VM system at vm_bootstrap() time. Free
+ * frames are kept on a doubly-linked list threaded through the
+ * entries, so allocating or freeing a single page is O(1); a
+ * multi-page allocation is a first-fit search for a run of free
+ * frames, which are then unlinked from the free list one by one.
+ *
+ * Before coremap_bootstrap() has run, allocations are satisfied by
+ * ram_stealmem(). Those pages lie below the coremap and are never
+ * reclaimed; freeing them is silently ignored.
+ *
+ * Frames holding user pages remember which struct vpage they belong
+ * to. When there is no free memory, the coremap evicts user pages to
+ * make room, choosing them with the current replacement policy
+ * (vmpolicy.h); the default is the clock algorithm. Dirty pages go to
+ * the compressed page store (zpool.h) if they fit there, and to swap
+ * otherwise; clean ones are just dropped, and read again from their
+ * file or zero-filled when next used. Kernel allocations may evict
+ * pages too, but only if the caller is able to sleep; from interrupt
+ * handlers or with a spinlock held they simply fail.
+ *
+ * So that zero-fill page faults don't have to clear a frame on the
+ * spot, a kernel thread keeps a pool of free frames zeroed ahead of
+ * time, working only when no other thread wants the CPU. Free frames
+ * are on one of two lists, zeroed or not; allocations that need a
+ * zeroed frame take one from the pool if there is one, and all
+ * others take from the other list first.
+ *
+ * Functions:
+ *     coremap_bootstrap  - take over all remaining physical memory.
+ *     coremap_alloc      - allocate NPAGES physically contiguous
+ *                          frames for the kernel. Returns 0 if none
+ *                          are available.
+ *     coremap_alloc_user - allocate one frame for the user page VP,
+ *                          which the caller must hold locked, zero-
+ *                          filled if ZERO is set. Returns 0 if none
+ *                          is available.
+ *     coremap_alloc_reserve - allocate one frame for the kernel
+ *                          without evicting anything, dipping into a
+ *                          few frames kept back for this. Returns 0 if
+ *                          there are none. For the compressed page
+ *                          store (zpool.h).
+ *     coremap_free       - free a frame or run of frames from any of
+ *                          the above.
+ *     coremap_settag     - record TAG, a pointer of the owner's choosing,
+ *                          for the kernel frame PADDR; kmalloc points
+ *                          the pages it splits into blocks at their
+ *                          pagerefs this way. Returns false, and does
+ *                          nothing, for frames from before
+ *                          coremap_bootstrap. Freeing the frame resets
+ *                          it to NULL.
+ *     coremap_gettag     - get the tag of the kernel frame PADDR into
+ *                          *TAG, or return false if the frame predates
+ *                          the coremap. Doesn't lock, so only for frames
+ *                          the caller knows are still allocated.
+ *     coremap_startzeroing - start the zeroing thread; called from
+ *                          vm_bootstrap.
+ *     coremap_getstats   - report the number of frames in use and the
+ *                          total number of frames managed.
+ */
+
+struct vpage;
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+paddr_t coremap_alloc_user(struct vpage *vp, bool zero);
+paddr_t coremap_alloc_reserve(void);
+void coremap_free(paddr_t paddr);
+bool coremap_settag(paddr_t paddr, void *tag);
+bool coremap_gettag(paddr_t paddr, void **tag);
+void coremap_startzeroing(void);
+void coremap_getstats(unsigned *used, unsigned *total);
+
+
+#endif /* _COREMAP_H_ */
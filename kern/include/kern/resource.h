@@ -33,7 +33,15 @@
 /*
  * Definitions for resource usage and limits.
  *
- * Not very important.
+ * Of struct rusage, only the virtual memory fields are filled in:
+ * ru_maxrss, ru_minflt, ru_majflt, and the OS/161 additions at the
+ * end. Every TLB miss is counted in ru_tlbfaults and in exactly one
+ * of the five kinds after it; ru_minflt is those needing no I/O
+ * (reloads, zero-fill, and the compressed store) and ru_majflt the
+ * rest. Swap I/O is charged to the process whose fault or allocation
+ * caused it, which for page-outs need not be the owner of the page.
+ * For RUSAGE_CHILDREN, ru_maxrss is the largest of the children's and
+ * ru_rss is 0.
  */
 
 
@@ -67,6 +75,18 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+
+	/* OS/161 additions */
+	__size_t ru_rss;		/* current RSS (kb) */
+	__counter_t ru_tlbfaults;	/* TLB misses (count) */
+	__counter_t ru_reloads;		/* ...for pages in memory (count) */
+	__counter_t ru_zerofaults;	/* ...for new zeroed pages (count) */
+	__counter_t ru_filefaults;	/* ...read from a file (count) */
+	__counter_t ru_swapfaults;	/* ...read from swap (count) */
+	__counter_t ru_zpoolfaults;	/* ...from compressed pages (count) */
+	__counter_t ru_cowfaults;	/* copy-on-write copies (count) */
+	__counter_t ru_swapins;		/* pages read from swap (count) */
+	__counter_t ru_swapouts;	/* pages written to swap (count) */
 };
 
 /* limit codes for getrusage/setrusage */
@@ -0,0 +1,23 @@
+#ifndef _KERN_SHM_H_
+#define _KERN_SHM_H_
+
+/*
+ * Definitions for the System V-style shared memory calls shmget(),
+ * shmat(), shmdt() and shmctl().
+ */
+
+/* Key that always makes a new segment (shmget KEY argument) */
+#define IPC_PRIVATE   0
+
+/* shmget flags; the low 9 bits (permissions) are accepted and ignored */
+#define IPC_CREAT     0x0200 /* Create the segment if it doesn't exist */
+#define IPC_EXCL      0x0400 /* ...and fail if it does */
+
+/* shmat flags */
+#define SHM_RDONLY    0x1000 /* Attach read-only */
+
+/* shmctl commands */
+#define IPC_RMID      0      /* Remove the key, and the segment once unused */
+
+
+#endif /* _KERN_SHM_H_ */
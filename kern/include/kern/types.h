@@ -71,6 +71,7 @@ typedef __i32 __gid_t;     /* Group ID */
 typedef __u32 __in_addr_t; /* Internet address */
 typedef __u32 __in_port_t; /* Internet port number */
 typedef __u32 __ino_t;     /* Inode number */
+typedef __i32 __key_t;     /* IPC key */
 typedef __u32 __mode_t;    /* File access mode */
 typedef __u16 __nlink_t;   /* Number of links (intentionally only 16 bits) */
 typedef __i64 __off_t;     /* Offset within file */
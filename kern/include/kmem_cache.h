@@ -0,0 +1,86 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A cache hands out objects of one fixed size, carved from whole
+ * pages ("slabs") that belong to it. This is for structures the
+ * kernel makes and throws away all the time, like threads, processes
+ * and locks: they come from their own pages instead of the general
+ * heap, and an object that is freed goes back to its slab as it is,
+ * ready to be handed out again.
+ *
+ * A cache may have a constructor, run on each object when its slab
+ * is made, and a destructor, run when the slab is given back. Objects
+ * are kept in their constructed state while they're free: whoever
+ * frees one must first undo anything they did to it that the
+ * constructor didn't, so the next user gets it as the constructor
+ * left it. That way work such as making an object's wait channel is
+ * done once per slab rather than once per use. The constructor
+ * returns an error code, or 0; it may allocate, including from other
+ * caches, and may sleep, but the destructor mustn't fail.
+ *
+ * A cache keeps one empty slab around; slabs beyond that are
+ * destroyed as soon as they empty, so a burst of allocations doesn't
+ * hold on to memory forever.
+ *
+ * The structure is public only so caches can be defined statically
+ * with KMEM_CACHE_INITIALIZER, which needs no setup call and so works
+ * from the very start of boot. Don't use its fields.
+ *
+ * Functions:
+ *     kmem_cache_create  - make a cache named NAME (not copied) for
+ *                          objects of SIZE bytes, which must fit
+ *                          several to a page. CTOR and DTOR may be NULL.
+ *     kmem_cache_destroy - destroy a cache with no objects allocated.
+ *     kmem_cache_alloc   - get an object, or NULL if out of memory.
+ *     kmem_cache_free    - give back an object from kmem_cache_alloc.
+ *     kmem_cache_printstats - report on all caches in use.
+ */
+
+#include <spinlock.h>
+
+struct kmem_slab;	/* Opaque */
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_objsize;
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	/* Set up on first use */
+	size_t kc_bufsize;		/* object plus free list link */
+	unsigned kc_perslab;		/* objects per slab; 0 until set up */
+
+	struct spinlock kc_lock;	/* protects the rest */
+	struct kmem_slab *kc_partial;	/* slabs with some objects free */
+	struct kmem_slab *kc_full;	/* slabs with none free */
+	struct kmem_slab *kc_empty;	/* slabs with all free */
+	unsigned kc_nslabs;
+	unsigned kc_nempty;
+
+	/* statistics */
+	unsigned kc_nallocs;
+	unsigned kc_nfrees;
+	unsigned kc_ngrows;		/* slabs made */
+	unsigned kc_nshrinks;		/* slabs destroyed */
+
+	struct kmem_cache *kc_next;	/* list of caches in use */
+	bool kc_listed;
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ (name), (size), (ctor), (dtor), 0, 0, SPINLOCK_INITIALIZER, \
+	  NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, NULL, false }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_printstats(void);
+
+
+#endif /* _KMEM_CACHE_H_ */
@@ -0,0 +1,43 @@
+#ifndef _KMPROF_H_
+#define _KMPROF_H_
+
+/*
+ * kmalloc profiling by call site.
+ *
+ * Only compiled in with "options kmprof" in the kernel config; without
+ * it, kmalloc and kfree don't call any of this, and none of it exists.
+ *
+ * Each kmalloc is charged to a site: the address it was called from,
+ * together with the size of block it got (the subpage block size, or
+ * whole pages for big allocations). Sites are kept in a fixed table,
+ * each counting allocations, frees, and allocations since the last
+ * report. Each live block is also recorded, in a second fixed table,
+ * so kfree can charge the free back to the right site. If either table
+ * fills up, later allocations are counted as untracked instead.
+ *
+ * kstrdup passes its blocks on to its own caller, or every name in the
+ * kernel would be charged to kstrdup.
+ *
+ * Call sites are printed as addresses; find the function and line
+ * with os161-addr2line -e kernel ADDRESS. A site whose live count only
+ * ever goes up is a leak.
+ *
+ * Functions:
+ *     kmprof_bootstrap  - start the clock for allocation rates; called
+ *                         from boot once the clock device is attached.
+ *     kmprof_alloc      - note that CALLER got block PTR of BYTES bytes.
+ *     kmprof_free       - note that block PTR is being freed.
+ *     kmprof_recaller   - charge the live block PTR to CALLER instead.
+ *     kmprof_printstats - report the sites with the most live bytes,
+ *                         and those allocating fastest since the last
+ *                         report. Starts a new rate interval.
+ */
+
+void kmprof_bootstrap(void);
+void kmprof_alloc(void *ptr, size_t bytes, const void *caller);
+void kmprof_free(void *ptr);
+void kmprof_recaller(void *ptr, const void *caller);
+void kmprof_printstats(void);
+
+
+#endif /* _KMPROF_H_ */
@@ -0,0 +1,52 @@
+#ifndef _PAGEMERGE_H_
+#define _PAGEMERGE_H_
+
+/*
+ * Same-page merging.
+ *
+ * When turned on, a kernel thread wakes up every few seconds and
+ * scans the resident private pages of every process, looking for
+ * pages with identical contents: zero pages that were touched but
+ * never written, and data that forked children haven't changed yet
+ * but have stopped sharing (or never shared, if they were started
+ * separately). Each duplicate found is replaced in its page table by
+ * the page it duplicates, freeing its frame. The page that is kept
+ * now has more than one reference, so it is copy-on-write like any
+ * page shared by fork, and vm_fault splits it again on the first
+ * write.
+ *
+ * Pages of MAP_SHARED regions and text pages are left alone: the
+ * former must stay writable in place, and the latter are already
+ * shared through the text cache.
+ *
+ * Candidates are found by hashing the whole page, and only merged
+ * after the contents are compared and found equal, with all TLB
+ * entries for both pages gone so nothing can write them meanwhile.
+ *
+ * The thread changes page tables other than its own process's, so
+ * it takes each address space's as_lock and waits for faults in it
+ * to finish (as_scanbegin; see addrspace.h).
+ *
+ * Functions:
+ *     pagemerge_bootstrap  - set up and start the thread, turned off.
+ *                            Called from vm_bootstrap.
+ *     pagemerge_register   - make AS, which must be fully set up,
+ *                            visible to the thread. If there's no
+ *                            memory for that, it's just not scanned.
+ *     pagemerge_unregister - take AS out of sight again; called when
+ *                            destroying it. May wait for a scan to
+ *                            finish.
+ *     pagemerge_enable     - turn merging on or off.
+ *     pagemerge_printstats - report what merging has done.
+ */
+
+struct addrspace;
+
+void pagemerge_bootstrap(void);
+void pagemerge_register(struct addrspace *as);
+void pagemerge_unregister(struct addrspace *as);
+void pagemerge_enable(bool on);
+void pagemerge_printstats(void);
+
+
+#endif /* _PAGEMERGE_H_ */
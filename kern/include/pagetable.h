@@ -0,0 +1,46 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page table.
+ *
+ * A two-level table mapping user virtual page numbers to logical
+ * pages (struct vpage). The top level has one slot for every 4M of
+ * user address space; second-level tables are one page each and are
+ * only allocated once something in their range is mapped, so the
+ * cost of a sparse address space is proportional to what is used.
+ *
+ * Functions:
+ *     pt_create   - create an empty page table. Returns NULL if out
+ *                   of memory.
+ *     pt_destroy  - free a page table. All entries must already have
+ *                   been removed.
+ *     pt_lookup   - return the page mapped at VADDR, or NULL.
+ *     pt_insert   - map VP at VADDR, which must not already be
+ *                   mapped. Returns ENOMEM if a second-level table
+ *                   was needed and could not be allocated.
+ *     pt_remove   - unmap VADDR and return what was mapped there
+ *                   (possibly NULL).
+ *     pt_foreach  - call FUNC on each mapped page with START <= vaddr
+ *                   < END, in address order, skipping unpopulated
+ *                   second-level tables. FUNC gets the slot itself
+ *                   and may clear or replace the entry. Stops early
+ *                   and returns FUNC's result if that is nonzero.
+ */
+
+struct vpage;
+struct pagetable;
+
+typedef int (*pt_foreach_func)(vaddr_t vaddr, struct vpage **slot,
+			       void *data);
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+struct vpage *pt_lookup(struct pagetable *pt, vaddr_t vaddr);
+int pt_insert(struct pagetable *pt, vaddr_t vaddr, struct vpage *vp);
+struct vpage *pt_remove(struct pagetable *pt, vaddr_t vaddr);
+int pt_foreach(struct pagetable *pt, vaddr_t start, vaddr_t end,
+	       pt_foreach_func func, void *data);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -41,6 +41,8 @@
 #include "opt-A2.h"
 #include <synch.h>
 #include <limits.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 
 struct addrspace;
 struct vnode;
@@ -58,6 +60,9 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct rusage p_usage;		/* VM activity, for getrusage */
+	struct rusage p_childusage;	/* ...of waited-for children */
+	unsigned p_rsssample;		/* page-ins since ru_rss was counted */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -94,6 +99,9 @@ typedef struct {
 	//synchronization primitives for exit, waitpid
 
   	struct semaphore *p_sem;
+
+	//VM usage of the process and its children, kept for the parent's getrusage
+	struct rusage p_usage;
   	
 } Pid;
 
@@ -136,6 +144,22 @@ struct addrspace *curproc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *curproc_setas(struct addrspace *);
 
+/*
+ * Count a VM event against the current process: FIELD names a counter
+ * in struct rusage. Kernel threads aren't counted. A user process has
+ * only one thread, and only it changes its counts, so there's no
+ * locking. Needs <current.h>.
+ */
+#define PROC_USAGE_INC(field) \
+	do { \
+		if (curproc != NULL && curproc != kproc) { \
+			curproc->p_usage.field++; \
+		} \
+	} while (0)
+
+/* Add the usage MORE into TOTAL; for RUSAGE_CHILDREN. */
+void proc_addusage(struct rusage *total, const struct rusage *more);
+
 #if OPT_A2
 
 	pid_t pid_create(void);
@@ -158,6 +182,10 @@ struct addrspace *curproc_setas(struct addrspace *);
 
 	struct semaphore *pid_getsem(pid_t pid);
 
+	void pid_setusage(pid_t pid, const struct rusage *usage);
+
+	const struct rusage *pid_getusage(pid_t pid);
+
 #endif /* OPT_A2 */
 
 #endif /* _PROC_H_ */
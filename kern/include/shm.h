@@ -0,0 +1,51 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Shared memory segments (System V-style).
+ *
+ * A segment is a fixed set of anonymous pages, named by an id and
+ * optionally found by a key, that any number of address spaces can
+ * map. The segment holds one reference to each of its pages, created
+ * zero-filled up front, and each address space mapping it holds
+ * another in its page table, so the pages are shared like those of a
+ * MAP_SHARED anonymous region and are never copied on write. A
+ * mapping is a region with rg_shm set (see addrspace.h); fork copies
+ * it like any shared region.
+ *
+ * The segment counts its attachments. When the last one is detached,
+ * or when the key is removed with no attachments, it goes away, and
+ * so do its pages once nothing maps them.
+ *
+ * Functions:
+ *     shm_bootstrap - set up; called from vm_bootstrap.
+ *     shm_get       - find the segment with key KEY, or make a new one
+ *                     of SIZE bytes, according to the IPC_* flags in
+ *                     <kern/shm.h>. Returns its id.
+ *     shm_remove    - remove segment ID's key; it goes away now if
+ *                     nothing has it attached.
+ *     shm_attach    - look up segment ID and count an attachment.
+ *                     Returns NULL if there's no such segment.
+ *     shm_incref    - count another attachment to a segment already
+ *                     attached (for fork).
+ *     shm_detach    - drop an attachment.
+ *     shm_npages    - size of a segment, in pages.
+ *     shm_page      - page I of a segment.
+ *
+ * All may sleep.
+ */
+
+struct shmseg;
+struct vpage;
+
+void shm_bootstrap(void);
+int shm_get(key_t key, size_t size, int flags, int *id);
+int shm_remove(int id);
+struct shmseg *shm_attach(int id);
+void shm_incref(struct shmseg *seg);
+void shm_detach(struct shmseg *seg);
+size_t shm_npages(struct shmseg *seg);
+struct vpage *shm_page(struct shmseg *seg, unsigned i);
+
+
+#endif /* _SHM_H_ */
@@ -0,0 +1,37 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Pages evicted from memory are written to the raw disk lhd1 (the
+ * second disk; lhd0 is left for the file system). The disk is divided
+ * into page-sized slots, tracked with a bitmap. If there is no such
+ * disk, paging is simply turned off and running out of memory fails
+ * the allocation as before.
+ *
+ * Functions:
+ *     swap_bootstrap - open the swap disk. Called from vm_bootstrap,
+ *                      after devices have been attached.
+ *     swap_enabled   - true if there is a swap disk.
+ *     swap_alloc     - reserve a slot. Returns ENOSPC if the swap disk
+ *                      is full.
+ *     swap_free      - release a slot.
+ *     swap_pagein    - read slot SLOT into the frame at PADDR.
+ *     swap_pageout   - write the frame at PADDR to slot SLOT.
+ *
+ * The I/O functions may sleep.
+ */
+
+/* Slot number meaning "none" */
+#define SWAP_NOSLOT	((unsigned)-1)
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_alloc(unsigned *slot);
+void swap_free(unsigned slot);
+int swap_pagein(unsigned slot, paddr_t paddr);
+int swap_pageout(unsigned slot, paddr_t paddr);
+
+
+#endif /* _SWAP_H_ */
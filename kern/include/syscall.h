@@ -57,10 +57,20 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_sbrk(intptr_t amount, int32_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+	     int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_shmget(key_t key, size_t size, int flags, int32_t *retval);
+int sys_shmat(int id, userptr_t addr, int flags, int32_t *retval);
+int sys_shmdt(userptr_t addr);
+int sys_shmctl(int id, int cmd, userptr_t buf);
+int sys_getrusage(int who, userptr_t usage);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 void sys__exit(int exitcode);
+void proc_exit(int waitstatus);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 
@@ -78,7 +78,9 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int malloctiming(int, char **);
 int nettest(int, char **);
+int mmaptest(int, char **);
 
 /* Routine for running a user-level program. */
 
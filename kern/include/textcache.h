@@ -0,0 +1,38 @@
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Text page cache.
+ *
+ * Read-only pages read from an executable are the same in every
+ * process running it, so rather than each process reading its own
+ * copy, they share one struct vpage. The cache finds the page for a
+ * given piece of a file: LEN bytes at OFFSET in vnode V, followed by
+ * zeros to the end of the page.
+ *
+ * The cache does not hold references to pages; a page stays in it
+ * only while something maps it. Since whatever maps it also holds a
+ * reference to the file, the vnode pointer in the key can't be reused
+ * for another file while the entry exists.
+ *
+ * Functions:
+ *     textcache_lookup - return the cached page for the key, with a
+ *                        new reference added, or NULL if there isn't
+ *                        one.
+ *     textcache_insert - add VP, which has just been read in from the
+ *                        file, under the key. If there's no memory for
+ *                        the entry, VP just isn't cached.
+ *     textcache_remove - take VP out of the cache; called by
+ *                        vpage_destroy.
+ */
+
+struct vnode;
+struct vpage;
+
+struct vpage *textcache_lookup(struct vnode *v, off_t offset, size_t len);
+void textcache_insert(struct vnode *v, off_t offset, size_t len,
+		      struct vpage *vp);
+void textcache_remove(struct vpage *vp);
+
+
+#endif /* _TEXTCACHE_H_ */
@@ -121,6 +121,7 @@ typedef __gid_t gid_t;
 typedef __in_addr_t in_addr_t;
 typedef __in_port_t in_port_t;
 typedef __ino_t ino_t;
+typedef __key_t key_t;
 typedef __mode_t mode_t;
 typedef __nlink_t nlink_t;
 typedef __off_t off_t;
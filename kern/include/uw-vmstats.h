@@ -12,7 +12,7 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions (except vmstats_print) whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by turning interrupts off (splhigh).
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally (except vmstats_print).
  *
@@ -36,7 +36,14 @@
 #define VMSTAT_ELF_FILE_READ          (7)
 #define VMSTAT_SWAP_FILE_READ         (8)
 #define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#define VMSTAT_FAULTAROUND_LOAD      (10)
+#define VMSTAT_PAGE_FAULT_COMPRESSED (11)
+#define VMSTAT_ZPOOL_STORE           (12)
+#define VMSTAT_ZPOOL_BYTES           (13)
+#define VMSTAT_ZPOOL_REJECT          (14)
+#define VMSTAT_ZPOOL_SPILL           (15)
+#define VMSTAT_FAULTAROUND_MISS      (16)
+#define VMSTAT_COUNT                 (17)
 
 /* ----------------------------------------------------------------------- */
 
@@ -52,6 +59,13 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
 void vmstats_inc(unsigned int index);    /* uses locking */
 void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
 
+/* Add to the specified count
+ * Example use:
+ *   vmstats_add(VMSTAT_ZPOOL_BYTES, len);
+ */
+void vmstats_add(unsigned int index, unsigned int amount);    /* uses locking */
+void _vmstats_add(unsigned int index, unsigned int amount);   /* atomicity must be ensured elsewhere */
+
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
 
@@ -51,6 +51,32 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Bring the current process's usage (kern/resource.h) up to date:
+ * recount the resident pages in its address space AS, which is
+ * locked, for ru_rss and ru_maxrss, and total up ru_minflt and
+ * ru_majflt. vm_fault recounts every so often by itself. Not for
+ * dumbvm.
+ */
+struct addrspace;
+void vm_updateusage(struct addrspace *as);
+
+/*
+ * Fault-around: on each TLB miss, vm_fault also loads entries for the
+ * other resident pages in the aligned window of vm_faultaround pages
+ * around the faulting one. 0 or 1 turns it off. It must be a power of
+ * two no larger than VM_FAULTAROUND_MAX.
+ *
+ * VMSTAT_FAULTAROUND_LOAD counts the entries loaded this way, and
+ * VMSTAT_FAULTAROUND_MISS the TLB misses on pages whose entry was
+ * loaded but was gone again before being used. The difference is how
+ * many misses fault-around saved (at most; an entry evicted unused
+ * on a page never touched again counts as saved too).
+ */
+#define VM_FAULTAROUND_DEFAULT	4
+#define VM_FAULTAROUND_MAX	16	/* at most 32, for as_faloaded */
+extern unsigned vm_faultaround;
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
@@ -59,5 +85,39 @@ void free_kpages(vaddr_t addr);
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Machine-dependent TLB management, for the VM system's use. Except
+ * for tlb_forget and tlb_shootdown_paddr, these act on the current
+ * CPU's TLB only.
+ *
+ *    tlb_activate   - switch the TLB to address space AS, giving it an
+ *                     address space ID if it needs one. Entries for
+ *                     other address spaces are kept where possible.
+ *    tlb_forget     - make all entries for AS, on every CPU, unusable.
+ *    tlb_flush      - invalidate every entry.
+ *    tlb_insert     - load a translation for VADDR -> PADDR in the
+ *                     current address space, replacing any existing
+ *                     entry for VADDR. If WRITABLE is false, writes
+ *                     through it fault with VM_FAULT_READONLY.
+ *    tlb_preload    - the same, but for a page that hasn't faulted,
+ *                     so an existing entry is left alone. Returns
+ *                     whether a new entry was loaded.
+ *    tlb_invalidate - drop the entry for VADDR in the current address
+ *                     space, if there is one.
+ *    tlb_invalidate_paddr - drop any entries that map to the frame
+ *                     PADDR.
+ *    tlb_shootdown_paddr - the same, on every CPU, returning once all
+ *                     have done it. May not be called holding a
+ *                     spinlock; see ipi_tlbshootdown_wait in <cpu.h>.
+ */
+void tlb_activate(struct addrspace *as);
+void tlb_forget(struct addrspace *as);
+void tlb_flush(void);
+void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool writable);
+bool tlb_preload(vaddr_t vaddr, paddr_t paddr, bool writable);
+void tlb_invalidate(vaddr_t vaddr);
+void tlb_invalidate_paddr(paddr_t paddr);
+void tlb_shootdown_paddr(paddr_t paddr);
+
 
 #endif /* _VM_H_ */
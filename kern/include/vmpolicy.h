@@ -0,0 +1,71 @@
+#ifndef _VMPOLICY_H_
+#define _VMPOLICY_H_
+
+/*
+ * Page replacement policies.
+ *
+ * When the coremap needs to evict a user page, it asks the current
+ * policy which frame to take. Frames are named by their index in the
+ * coremap. The coremap tells the policy when a frame starts or stops
+ * holding a user page, so a policy that keeps its own order (FIFO)
+ * can track them; policies that don't can ignore this.
+ *
+ * Every call except vmp_init is made with the coremap lock held, so
+ * a policy's state needs no locking of its own, and a policy may not
+ * sleep or allocate memory except in vmp_init.
+ *
+ * Operations:
+ *     vmp_name   - name for the kernel menu.
+ *     vmp_init   - set up for NFRAMES frames. Called once, at boot.
+ *     vmp_reset  - forget everything; the policy is about to become
+ *                  current and be told about each user frame with
+ *                  vmp_add.
+ *     vmp_add    - FRAME now holds a user page.
+ *     vmp_remove - FRAME no longer holds a user page.
+ *     vmp_choose - pick a frame to evict and lock it with
+ *                  coremap_lockframe; or return VMPOLICY_NONE if
+ *                  nothing can be locked.
+ *
+ * Helpers the coremap provides for vmp_choose:
+ *     coremap_lockframe    - if FRAME holds a user page that can be
+ *                            evicted, lock the page and return true.
+ *     coremap_unlockframe  - unlock it again, to pass it over.
+ *     coremap_testclearref - for a locked frame, return whether its
+ *                            page has been used since last asked, and
+ *                            clear the flag; the page's TLB entries
+ *                            go too, so that the next use sets it.
+ *
+ * Functions:
+ *     vmpolicy_bootstrap - set up all the policies and make the
+ *                          default current. Called from vm_bootstrap.
+ *     vmpolicy_select    - make the policy called NAME current.
+ *                          Returns EINVAL if there's no such policy.
+ *     vmpolicy_current   - name of the current policy.
+ *     vmpolicy_list      - print the names of all the policies.
+ */
+
+#define VMPOLICY_NONE	((unsigned)-1)
+
+struct vmpolicy {
+	const char *vmp_name;
+	int (*vmp_init)(unsigned nframes);
+	void (*vmp_reset)(void);
+	void (*vmp_add)(unsigned frame);
+	void (*vmp_remove)(unsigned frame);
+	unsigned (*vmp_choose)(void);
+};
+
+/* In coremap.c */
+bool coremap_lockframe(unsigned frame);
+void coremap_unlockframe(unsigned frame);
+bool coremap_testclearref(unsigned frame);
+void coremap_setpolicy(const struct vmpolicy *policy);
+
+/* In vmpolicy.c */
+void vmpolicy_bootstrap(void);
+int vmpolicy_select(const char *name);
+const char *vmpolicy_current(void);
+void vmpolicy_list(void);
+
+
+#endif /* _VMPOLICY_H_ */
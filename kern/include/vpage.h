@@ -0,0 +1,129 @@
+#ifndef _VPAGE_H_
+#define _VPAGE_H_
+
+#include <spinlock.h>
+
+/*
+ * Logical page: the machine-independent state of one page of user
+ * memory. Page tables map virtual page numbers to these; the physical
+ * frame behind a page lives here rather than in the page table so
+ * the frame can later be shared, moved, or paged out without hunting
+ * down every page table that refers to it.
+ *
+ * After fork, parent and child share their pages copy-on-write: each
+ * page table that maps a vpage holds one reference to it, and a page
+ * with more than one reference must not be written in place. Text
+ * pages are also shared between unrelated processes running the same
+ * program, through the text cache (textcache.h).
+ *
+ * A page is either resident (vp_paddr is its frame) or paged out
+ * (vp_paddr is 0 and the contents are in swap slot vp_swapslot). A
+ * resident page may also still have a swap slot; that means it has
+ * not been written since it was paged in, so it is clean and can be
+ * evicted again without writing it back. Such pages are only ever
+ * mapped read-only, so the first write faults and calls
+ * vpage_setdirty, which gives up the slot.
+ *
+ * Dirty pages are evicted to the compressed page store (zpool.h)
+ * if they compress well, and to swap only if not; vp_zslot and
+ * vp_zfill say where the compressed copy is. A page with a
+ * compressed copy has neither a frame nor a swap slot, and the copy
+ * is discarded when the page is brought back in.
+ *
+ * vp_modified says whether the page may have been written since it
+ * was read from its file or zero-filled. A page that hasn't been
+ * (text, untouched data and bss, and MAP_SHARED pages since they
+ * were written back) is simply dropped when evicted, leaving it with
+ * neither frame, swap slot, nor compressed copy; the fault path fills
+ * it again just as on first touch. Pages made by vpage_copy, or
+ * merged with another (pagemerge.h), start out modified, as there's
+ * nothing to fill them from. For MAP_SHARED file pages, which belong
+ * to the file rather than to swap, it also says whether the page has
+ * to be written back to the file when it is unmapped. Pages are
+ * mapped read-only until they have been marked modified, so the first
+ * write is noticed.
+ *
+ * Everything except the reference count is protected by the page's
+ * busy lock (vpage_lock/vpage_unlock), which is held across paging
+ * I/O and so may be held while sleeping. The reference count is
+ * protected by vp_lock, which also protects the busy flag itself.
+ * Since taking the busy lock requires vp_lock, holding vp_lock while
+ * the page is not busy also keeps the rest from changing; the fault
+ * path uses this to reload TLB entries without the busy lock.
+ */
+struct vpage {
+	paddr_t vp_paddr;		/* physical frame, or 0 */
+	unsigned vp_swapslot;		/* swap slot, or SWAP_NOSLOT */
+	unsigned vp_zslot;		/* compressed copy, or ZPOOL_NOSLOT */
+	uint32_t vp_zfill;		/* contents if ZPOOL_FILLED */
+	bool vp_referenced;		/* used since the clock hand passed */
+	bool vp_modified;		/* written since read or zero-filled */
+	bool vp_busy;			/* busy lock */
+	bool vp_wanted;			/* someone is waiting for the lock */
+	unsigned vp_refcount;		/* number of page tables mapping it */
+	struct textpage *vp_text;	/* text cache entry, or NULL */
+	struct spinlock vp_lock;
+};
+
+/*
+ * Functions:
+ *     vpage_bootstrap - set up; called from vm_bootstrap.
+ *
+ *     vpage_create    - create a new page backed by a zero-filled
+ *                       frame, with one reference. It is returned
+ *                       locked. Returns NULL if out of memory.
+ *     vpage_copy      - create a new page, with one reference, whose
+ *                       contents are a copy of an existing one, which
+ *                       must be locked and resident. It is returned
+ *                       locked. Returns NULL if out of memory.
+ *     vpage_incref    - add a reference.
+ *     vpage_tryincref - add a reference, unless the last one has
+ *                       already been dropped and the page is about to
+ *                       be destroyed. Returns whether it did. This is
+ *                       for the text cache, which holds no reference
+ *                       of its own.
+ *     vpage_decref    - drop a reference; frees the page, its frame,
+ *                       and its swap slot when the last one goes away.
+ *                       The caller must not hold the page locked.
+ *     vpage_isshared  - true if the page has more than one reference.
+ *                       Since only the owner of a reference can add
+ *                       another, a page seen unshared by the holder of
+ *                       its one reference stays that way.
+ *
+ *     vpage_lock      - lock a page. May sleep.
+ *     vpage_trylock   - lock a page if it is not already locked, and
+ *                       return whether it was. Does not sleep.
+ *     vpage_unlock    - unlock a page.
+ *
+ *     vpage_pagein    - make a locked page resident, reading it from
+ *                       the compressed store or swap if needed. A page
+ *                       that was dropped gets a zero-filled frame, and
+ *                       the caller must read in its file contents.
+ *     vpage_evict     - save a locked, resident page to the compressed
+ *                       store or swap if it is modified and has no
+ *                       copy in swap, and release its frame's
+ *                       contents. The caller (the coremap) is
+ *                       responsible for the frame itself.
+ *     vpage_setdirty  - note that a locked, resident page is about to
+ *                       be written, discarding any copy in swap.
+ */
+
+void vpage_bootstrap(void);
+
+struct vpage *vpage_create(void);
+struct vpage *vpage_copy(struct vpage *vp);
+void vpage_incref(struct vpage *vp);
+bool vpage_tryincref(struct vpage *vp);
+void vpage_decref(struct vpage *vp);
+bool vpage_isshared(struct vpage *vp);
+
+void vpage_lock(struct vpage *vp);
+bool vpage_trylock(struct vpage *vp);
+void vpage_unlock(struct vpage *vp);
+
+int vpage_pagein(struct vpage *vp);
+int vpage_evict(struct vpage *vp);
+void vpage_setdirty(struct vpage *vp);
+
+
+#endif /* _VPAGE_H_ */
@@ -0,0 +1,50 @@
+#ifndef _ZPOOL_H_
+#define _ZPOOL_H_
+
+/*
+ * Compressed page store.
+ *
+ * Eviction tries this before the swap disk: a dirty page being paged
+ * out is compressed, and if it shrinks enough the compressed copy is
+ * kept in memory instead of being written out. Pages filled with one
+ * repeated word (most often zero) take no space at all; the word is
+ * kept in the page itself. Other pages are compressed with a small
+ * LZ77-style coder into 256-byte chunks of frames the store takes
+ * from the coremap as it grows, up to an eighth of memory.
+ *
+ * When the store is full, the pages that have been in it longest are
+ * written to swap to make room. There's no point keeping a page
+ * whose compressed copy doesn't fit in three quarters of a page; such
+ * pages go straight to swap.
+ *
+ * A page's compressed copy is named by vp_zslot: ZPOOL_NOSLOT if it
+ * has none, ZPOOL_FILLED if it is filled with vp_zfill, or else the
+ * chunk its data starts at. A page never has both a compressed copy
+ * and a frame.
+ *
+ * Functions:
+ *     zpool_bootstrap - set up; called from vm_bootstrap.
+ *     zpool_enabled   - true once set up.
+ *     zpool_store     - keep a compressed copy of the locked, resident,
+ *                       dirty page VP. Returns ENOSPC if it doesn't
+ *                       compress well enough or there's no room; the
+ *                       caller then writes it to swap. Doesn't touch
+ *                       the frame. May sleep.
+ *     zpool_load      - decompress the locked page VP's copy into the
+ *                       frame PADDR, and discard the copy. May sleep.
+ *     zpool_drop      - discard the locked page VP's copy. May sleep.
+ */
+
+#define ZPOOL_NOSLOT	((unsigned)-1)
+#define ZPOOL_FILLED	((unsigned)-2)
+
+struct vpage;
+
+void zpool_bootstrap(void);
+bool zpool_enabled(void);
+int zpool_store(struct vpage *vp);
+void zpool_load(struct vpage *vp, paddr_t paddr);
+void zpool_drop(struct vpage *vp);
+
+
+#endif /* _ZPOOL_H_ */
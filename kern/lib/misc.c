@@ -30,6 +30,8 @@
 #include <types.h>
 #include <kern/errmsg.h>
 #include <lib.h>
+#include <kmprof.h>
+#include "opt-kmprof.h"
 
 /*
  * Like strdup, but calls kmalloc.
@@ -43,6 +45,10 @@ kstrdup(const char *s)
 	if (z == NULL) {
 		return NULL;
         }
+#if OPT_KMPROF
+	/* Charge it to whoever wanted the copy. */
+	kmprof_recaller(z, __builtin_return_address(0));
+#endif
 	strcpy(z, s);
 	return z;
 }
@@ -54,6 +54,7 @@
 #include <limits.h>
 #include <kern/errno.h>
 #include <thread.h>
+#include <kmem_cache.h>
 
 
 /*
@@ -85,6 +86,35 @@ static struct lock *process_Pids_lock;
 
 #endif  // UW
 
+/*
+ * Proc structures come from an object cache. A free one keeps its
+ * lock, and its (empty) thread array with whatever space that has.
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+}
+
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc),
+			       proc_ctor, proc_dtor);
+
 /*
  * Create a proc structure.
  */
@@ -94,21 +124,23 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_childusage, sizeof(proc->p_childusage));
+	proc->p_rsssample = 0;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -183,11 +215,11 @@ proc_destroy(struct proc *proc)
 
 	#endif
 
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	KASSERT(!spinlock_do_i_hold(&proc->p_lock));
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -265,7 +297,8 @@ proc_create_runprogram(const char *name)
 
 		proc->p_pid = pid_create();
 		if(proc->p_pid < PID_MIN) {
-			kfree(proc);
+			kfree(proc->p_name);
+			kmem_cache_free(&proc_cache, proc);
 			return NULL;
 		}
 
@@ -409,6 +442,31 @@ curproc_setas(struct addrspace *newas)
 	return oldas;
 }
 
+/*
+ * Add one process's usage into another's total, as when a child is
+ * waited for. Only the fields the VM system keeps are added. The peak
+ * is the larger of the two; ru_rss stays as it was, since it means
+ * nothing for a total.
+ */
+void
+proc_addusage(struct rusage *total, const struct rusage *more)
+{
+	total->ru_minflt += more->ru_minflt;
+	total->ru_majflt += more->ru_majflt;
+	total->ru_tlbfaults += more->ru_tlbfaults;
+	total->ru_reloads += more->ru_reloads;
+	total->ru_zerofaults += more->ru_zerofaults;
+	total->ru_filefaults += more->ru_filefaults;
+	total->ru_swapfaults += more->ru_swapfaults;
+	total->ru_zpoolfaults += more->ru_zpoolfaults;
+	total->ru_cowfaults += more->ru_cowfaults;
+	total->ru_swapins += more->ru_swapins;
+	total->ru_swapouts += more->ru_swapouts;
+	if (more->ru_maxrss > total->ru_maxrss) {
+		total->ru_maxrss = more->ru_maxrss;
+	}
+}
+
 #if OPT_A2
 
 pid_t 
@@ -436,7 +494,7 @@ pid_create(void)
 		return error;
 	}
 
-	process_Pids[pid] = kmalloc(sizeof(Pid*));
+	process_Pids[pid] = kmalloc(sizeof(Pid));
 	if (process_Pids[pid] == NULL) {
 		return error;
 	}
@@ -448,6 +506,8 @@ pid_create(void)
 
 	process_Pids[pid]->p_isExited= false;
 
+	bzero(&process_Pids[pid]->p_usage, sizeof(struct rusage));
+
 	process_Pids[pid]->p_sem = sem_create("p_sem", 0);
 	if (process_Pids[pid]->p_sem == NULL) {
 		kfree(process_Pids[pid]);
@@ -508,4 +568,12 @@ bool pid_checkexists(pid_t pid) {
 		return process_Pids[pid]->p_sem;
 	}
 
+	void pid_setusage(pid_t pid, const struct rusage *usage){
+		process_Pids[pid]->p_usage = *usage;
+	}
+
+	const struct rusage *pid_getusage(pid_t pid){
+		return &process_Pids[pid]->p_usage;
+	}
+
 #endif
@@ -50,6 +50,15 @@
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-A3.h"
+#include "opt-dumbvm.h"
+#include "opt-kmprof.h"
+#if OPT_A3 && !OPT_DUMBVM
+#include <uw-vmstats.h>
+#endif
+#if OPT_KMPROF
+#include <kmprof.h>
+#endif
 
 
 /*
@@ -120,6 +129,10 @@ boot(void)
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
+#if OPT_KMPROF
+	/* Needs the clock. */
+	kmprof_bootstrap();
+#endif
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
@@ -146,6 +159,9 @@ shutdown(void)
 {
 
 	kprintf("Shutting down.\n");
+#if OPT_A3 && !OPT_DUMBVM
+	vmstats_print();
+#endif
 	
 	vfs_clearbootfs();
 	vfs_clearcurdir();
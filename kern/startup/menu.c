@@ -39,12 +39,19 @@
 #include <proc.h>
 #include <synch.h>
 #include <vfs.h>
+#include <vm.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <uw-vmstats.h>
+#include <vmpolicy.h>
+#include <pagemerge.h>
+#include <kmprof.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
+#include "opt-kmprof.h"
 /*
  * In-kernel menu and command dispatcher.
  */
@@ -405,10 +412,26 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
-	
+#if !OPT_DUMBVM
+	pagemerge_printstats();
+#endif
+
 	return 0;
 }
 
+#if OPT_KMPROF
+static
+int
+cmd_kmprof(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmprof_printstats();
+	return 0;
+}
+#endif
+
 /*
  * Command to turn debug statements for threads.
  *
@@ -425,6 +448,100 @@ cmd_dth(int nargs, char **args)
         return 0;
 }
 
+#if !OPT_DUMBVM
+/*
+ * Command to show or set the VM fault-around window, in pages.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	unsigned n;
+
+	if (nargs > 2) {
+		kprintf("Usage: fa [pages]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n > VM_FAULTAROUND_MAX || (n & (n - 1)) != 0) {
+			kprintf("fa: window must be 0 or a power of two "
+				"up to %u\n", VM_FAULTAROUND_MAX);
+			return EINVAL;
+		}
+		vm_faultaround = n;
+	}
+	kprintf("Fault-around window: %u pages\n", vm_faultaround);
+	return 0;
+}
+
+/*
+ * Command to show or set the page replacement policy.
+ */
+static
+int
+cmd_vmpolicy(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: vmpolicy [name]\n");
+		return EINVAL;
+	}
+	if (nargs == 2 && vmpolicy_select(args[1])) {
+		kprintf("vmpolicy: no policy %s; choose from: ", args[1]);
+		vmpolicy_list();
+		return EINVAL;
+	}
+	kprintf("Page replacement policy: %s\n", vmpolicy_current());
+	return 0;
+}
+
+/*
+ * Command to turn same-page merging on or off, and report on it.
+ */
+static
+int
+cmd_pagemerge(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: merge [on|off]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "on")) {
+			pagemerge_enable(true);
+		}
+		else if (!strcmp(args[1], "off")) {
+			pagemerge_enable(false);
+		}
+		else {
+			kprintf("Usage: merge [on|off]\n");
+			return EINVAL;
+		}
+	}
+	pagemerge_printstats();
+	return 0;
+}
+#endif
+
+/*
+ * Command to print the VM statistics, and with -z also reset them, so
+ * runs can be compared without rebooting.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "-z"))) {
+		kprintf("Usage: vs [-z]\n");
+		return EINVAL;
+	}
+	vmstats_print();
+	if (nargs == 2) {
+		vmstats_init();
+	}
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -467,6 +584,11 @@ static const char *opsmenu[] = {
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	"[dth]	  Enables debug statements for threads",
+#if !OPT_DUMBVM
+	"[fa]      Fault-around window       ",
+	"[vmpolicy] Page replacement policy  ",
+	"[merge]   Same-page merging         ",
+#endif
 	NULL
 };
 
@@ -486,11 +608,15 @@ static const char *testmenu[] = {
 	"[bt]  Bitmap test                   ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] kfree timing test             ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
 #if OPT_NET
 	"[net] Network test                  ",
+#endif
+#if !OPT_DUMBVM
+	"[mm1] Shared file mapping test      ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
@@ -534,6 +660,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_KMPROF
+	"[kmp] kmalloc profile by call site  ",
+#endif
+	"[vs] VM stats                       ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -579,6 +709,11 @@ static struct {
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
 	{ "dth",	cmd_dth },
+#if !OPT_DUMBVM
+	{ "fa",		cmd_faultaround },
+	{ "vmpolicy",	cmd_vmpolicy },
+	{ "merge",	cmd_pagemerge },
+#endif
 
 #if OPT_SYNCHPROBS
 	/* in-kernel synchronization problem(s) */
@@ -590,14 +725,22 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_KMPROF
+	{ "kmp",	cmd_kmprof },
+#endif
+	{ "vs",		cmd_vmstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	malloctiming },
 #if OPT_NET
 	{ "net",	nettest },
+#endif
+#if !OPT_DUMBVM
+	{ "mm1",	mmaptest },
 #endif
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
@@ -43,7 +43,10 @@
  * need to do anything.
  *
  * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * to rearrange this to map each segment. (Without dumbvm, that is
+ * what "loading" a chunk does: the segment is recorded with
+ * as_define_file and its pages are read in by vm_fault as the program
+ * touches them.)
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -52,6 +55,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/stat.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
@@ -59,6 +63,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-dumbvm.h"
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -81,8 +86,10 @@ load_segment(struct addrspace *as, struct vnode *v,
 	     size_t memsize, size_t filesize,
 	     int is_executable)
 {
+#if OPT_DUMBVM
 	struct iovec iov;
 	struct uio u;
+#endif
 	int result;
 
 	if (filesize > memsize) {
@@ -90,6 +97,33 @@ load_segment(struct addrspace *as, struct vnode *v,
 		filesize = memsize;
 	}
 
+#if !OPT_DUMBVM
+	/*
+	 * Don't read anything now; just note where the segment's
+	 * contents are. Check that they're all there, though, since a
+	 * short read at fault time can only kill the process.
+	 */
+	{
+		struct stat st;
+
+		(void)is_executable;
+
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
+		if (offset < 0 || offset + (off_t)filesize > st.st_size) {
+			kprintf("ELF: segment past end of file - "
+				"file truncated?\n");
+			return ENOEXEC;
+		}
+
+		DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+		      (unsigned long) filesize, (unsigned long) vaddr);
+
+		return as_define_file(as, vaddr, filesize, v, offset);
+	}
+#else
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
@@ -143,6 +177,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 #endif
 	
 	return result;
+#endif /* OPT_DUMBVM */
 }
 
 /*
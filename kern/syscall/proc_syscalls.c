@@ -8,7 +8,9 @@
 #include <proc.h>
 #include <thread.h>
 #include <addrspace.h>
+#include <vm.h>
 #include "opt-A2.h"
+#include "opt-dumbvm.h"
 #include <synch.h>
 #include <machine/trapframe.h>
 #include <copyinout.h>
@@ -35,14 +37,31 @@
 
 void sys__exit(int exitcode) {
 
+  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+
+  proc_exit(_MKWAIT_EXIT(exitcode));
+}
+
+/* Common part of _exit and of being killed by a fatal trap (see
+   kill_curthread). waitstatus is the already-encoded status waitpid
+   will report, made with _MKWAIT_EXIT or _MKWAIT_SIG.
+
+   Does not return.
+*/
+
+void proc_exit(int waitstatus) {
+
   struct addrspace *as;
   struct proc *p = curproc;
+  #if OPT_A2
+  struct rusage usage;
+  #endif
 
   #if OPT_A2
 
    pid_t curpid = p->p_pid;
 
-    pid_setexitstatus(curpid, exitcode);
+    pid_setexitstatus(curpid, waitstatus);
     pid_setisexited(curpid, true);
     
     struct semaphore *pid_sem = pid_getsem(curpid);
@@ -52,15 +71,26 @@ void sys__exit(int exitcode) {
     /* for now, just include this to keep the compiler from complaining about
     an unused variable */
     
-    (void)exitcode;
+    (void)waitstatus;
 
   #endif
 
+  KASSERT(curproc->p_addrspace != NULL);
 
+  #if OPT_A2
 
-  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+    #if !OPT_DUMBVM
+
+      /* Count the resident pages one last time, for the peak */
+      as = curproc->p_addrspace;
+      lock_acquire(as->as_lock);
+      vm_updateusage(as);
+      lock_release(as->as_lock);
+
+    #endif
+
+  #endif
 
-  KASSERT(curproc->p_addrspace != NULL);
   as_deactivate();
   /*
    * clear p_addrspace before calling as_destroy. Otherwise if
@@ -77,6 +107,14 @@ void sys__exit(int exitcode) {
 
   #if OPT_A2
 
+      /*
+       * Leave our usage, with our children's, for the parent to
+       * collect; after as_destroy, so paging it did is included.
+       */
+      usage = p->p_usage;
+      proc_addusage(&usage, &p->p_childusage);
+      pid_setusage(curpid, &usage);
+
       V(pid_sem);
 
   #endif
@@ -89,7 +127,7 @@ void sys__exit(int exitcode) {
   
   thread_exit();
   /* thread_exit() does not return, so we should never get here */
-  panic("return from thread_exit in sys_exit\n");
+  panic("return from thread_exit in proc_exit\n");
 }
 
 
@@ -223,7 +261,11 @@ sys_waitpid(pid_t pid,
 
     P(pid_sem);
 
-    exitstatus = _MKWAIT_EXIT(pid_getexitstatus(pid));
+    /* already encoded by proc_exit */
+    exitstatus = pid_getexitstatus(pid);
+
+    /* The child's usage now counts toward RUSAGE_CHILDREN */
+    proc_addusage(&curproc->p_childusage, pid_getusage(pid));
 
   if(status == NULL) {
     return EFAULT;
@@ -0,0 +1,203 @@
+/*
+ * Memory management system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <kern/shm.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <syscall.h>
+#include <shm.h>
+
+/*
+ * sbrk: move the end of the heap by AMOUNT bytes, returning where it
+ * used to be. New heap pages appear zero-filled as they are touched;
+ * pages released by a negative AMOUNT are freed immediately.
+ */
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbrk;
+	int result;
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	result = as_sbrk(as, amount, &oldbrk);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbrk;
+	return 0;
+}
+
+/*
+ * mmap: map LEN bytes of zero-filled memory. There is no file table
+ * yet, so only anonymous mappings can be made from userlevel; the fd
+ * and offset arguments, which come in on the stack, aren't looked at.
+ * ADDR is only used with MAP_FIXED. Bad flags or protections are
+ * EINVAL, checked before the missing file's EBADF, so the two can be
+ * told apart.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	int result;
+
+	if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		return EINVAL;
+	}
+	if (flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_FIXED | MAP_ANON)) {
+		return EINVAL;
+	}
+	if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+		/* Exactly one of them */
+		return EINVAL;
+	}
+	if ((flags & MAP_ANON) == 0) {
+		return EBADF;
+	}
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	vaddr = (vaddr_t)addr;
+	result = as_mmap(as, len, prot, flags, NULL, 0, &vaddr);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)vaddr;
+	return 0;
+}
+
+/*
+ * munmap: remove all or part of a mapping made by mmap.
+ */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/*
+ * shmget: find or make the shared memory segment with key KEY.
+ */
+int
+sys_shmget(key_t key, size_t size, int flags, int32_t *retval)
+{
+	int id, result;
+
+	if (flags & ~(IPC_CREAT | IPC_EXCL | 0777)) {
+		return EINVAL;
+	}
+	result = shm_get(key, size, flags, &id);
+	if (result) {
+		return result;
+	}
+	*retval = id;
+	return 0;
+}
+
+/*
+ * shmat: map segment ID at ADDR, or wherever there's room if ADDR is
+ * NULL.
+ */
+int
+sys_shmat(int id, userptr_t addr, int flags, int32_t *retval)
+{
+	struct addrspace *as;
+	struct shmseg *seg;
+	vaddr_t vaddr;
+	int result;
+
+	if (flags & ~SHM_RDONLY) {
+		return EINVAL;
+	}
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	seg = shm_attach(id);
+	if (seg == NULL) {
+		return EINVAL;
+	}
+	vaddr = (vaddr_t)addr;
+	result = as_shmat(as, seg, (flags & SHM_RDONLY) != 0, &vaddr);
+	if (result) {
+		shm_detach(seg);
+		return result;
+	}
+	*retval = (int32_t)vaddr;
+	return 0;
+}
+
+/*
+ * shmdt: unmap the segment mapped at ADDR.
+ */
+int
+sys_shmdt(userptr_t addr)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	return as_shmdt(as, (vaddr_t)addr);
+}
+
+/*
+ * shmctl: only IPC_RMID, which needs no buffer, is supported.
+ */
+int
+sys_shmctl(int id, int cmd, userptr_t buf)
+{
+	(void)buf;
+
+	if (cmd != IPC_RMID) {
+		return EINVAL;
+	}
+	return shm_remove(id);
+}
+
+/*
+ * getrusage: copy out the VM usage of the current process, or of its
+ * children that have been waited for. Our own resident page count is
+ * brought up to date first.
+ */
+int
+sys_getrusage(int who, userptr_t usage)
+{
+	struct addrspace *as;
+
+	switch (who) {
+	    case RUSAGE_SELF:
+		as = curproc_getas();
+		KASSERT(as != NULL);
+		lock_acquire(as->as_lock);
+		vm_updateusage(as);
+		lock_release(as->as_lock);
+		return copyout(&curproc->p_usage, usage,
+			       sizeof(struct rusage));
+	    case RUSAGE_CHILDREN:
+		return copyout(&curproc->p_childusage, usage,
+			       sizeof(struct rusage));
+	}
+	return EINVAL;
+}
@@ -34,6 +34,7 @@
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <test.h>
 
 /*
@@ -137,3 +138,74 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Time kfree as the kernel heap grows. At each step, allocate
+ * TIMEDBLOCKS blocks of TIMEDSIZE bytes, four to a page, then time
+ * freeing every other one; none of the pages becomes free, so this
+ * is the cost of finding each block's page, which shouldn't grow with
+ * the number of pages in use. Then free the rest and double the
+ * count, until TIMEDMAXBLOCKS or memory runs out.
+ */
+
+#define TIMEDSIZE       1000
+#define TIMEDMINBLOCKS    64
+#define TIMEDMAXBLOCKS  2048
+
+int
+malloctiming(int nargs, char **args)
+{
+	void **blocks;
+	unsigned n, i, got;
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+	uint32_t ns;
+
+	(void)nargs;
+	(void)args;
+
+	blocks = kmalloc(TIMEDMAXBLOCKS * sizeof(void *));
+	if (blocks == NULL) {
+		kprintf("kfree timing test: out of memory\n");
+		return 0;
+	}
+
+	kprintf("Starting kfree timing test...\n");
+
+	for (n = TIMEDMINBLOCKS; n <= TIMEDMAXBLOCKS; n *= 2) {
+		for (got = 0; got < n; got++) {
+			blocks[got] = kmalloc(TIMEDSIZE);
+			if (blocks[got] == NULL) {
+				break;
+			}
+		}
+		if (got < n) {
+			kprintf("kmalloc returned NULL after %u blocks\n",
+				got);
+			for (i = 0; i < got; i++) {
+				kfree(blocks[i]);
+			}
+			break;
+		}
+
+		gettime(&secs1, &nsecs1);
+		for (i = 0; i < n; i += 2) {
+			kfree(blocks[i]);
+		}
+		gettime(&secs2, &nsecs2);
+		getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+
+		for (i = 1; i < n; i += 2) {
+			kfree(blocks[i]);
+		}
+
+		/* Never anywhere near 4 seconds. */
+		ns = (uint32_t)secs * 1000000000 + nsecs;
+		kprintf("%4u pages: %u ns per kfree\n", n / 4,
+			ns / (n / 2));
+	}
+
+	kfree(blocks);
+	kprintf("kfree timing test done\n");
+	return 0;
+}
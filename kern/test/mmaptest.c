@@ -0,0 +1,259 @@
+/*
+ * mmaptest - check that shared file mappings are written back.
+ *
+ * There's no open() from userlevel yet, so this maps a file from the
+ * kernel instead: it writes a file, maps it MAP_SHARED into a fresh
+ * address space given to the menu's process for the duration, and
+ * writes to some of the pages through the mapping with copyout. It
+ * then unmaps from the middle, which splits the region in two and
+ * should write back exactly the pages it removes, writes to the
+ * upper piece, and destroys the address space, which should write
+ * back the rest. The file is read back with VOP_READ after each step.
+ *
+ * Each page of the file starts out filled with 'a' plus its number;
+ * a page written through the mapping gets 'A' plus its number.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+
+#define FILENAME	"mmaptest.tmp"
+#define NPAGES		8
+
+/* The pages unmapped from the middle */
+#define HOLEPAGE	2
+#define HOLEPAGES	3
+
+static char mmaptest_buf[PAGE_SIZE];
+
+static
+char
+mmaptest_byte(unsigned page, bool written)
+{
+	return (written ? 'A' : 'a') + page;
+}
+
+static
+void
+mmaptest_fillbuf(char ch)
+{
+	unsigned i;
+
+	for (i=0; i<PAGE_SIZE; i++) {
+		mmaptest_buf[i] = ch;
+	}
+}
+
+/*
+ * Read the file, and check that the pages in WRITTEN (bit i for page
+ * i) have been written back, and the others not.
+ */
+static
+int
+mmaptest_checkfile(const char *what, unsigned written)
+{
+	char name[32];
+	struct vnode *v;
+	struct iovec iov;
+	struct uio ku;
+	unsigned i, j;
+	char want;
+	int result;
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(name, FILENAME);
+	result = vfs_open(name, O_RDONLY, 0, &v);
+	if (result) {
+		kprintf("mmaptest: %s: open: %s\n", what, strerror(result));
+		return result;
+	}
+	for (i=0; i<NPAGES; i++) {
+		uio_kinit(&iov, &ku, mmaptest_buf, PAGE_SIZE,
+			  (off_t)i * PAGE_SIZE, UIO_READ);
+		result = VOP_READ(v, &ku);
+		if (result == 0 && ku.uio_resid != 0) {
+			result = EIO;
+		}
+		if (result) {
+			kprintf("mmaptest: %s: read: %s\n", what,
+				strerror(result));
+			vfs_close(v);
+			return result;
+		}
+		want = mmaptest_byte(i, (written & (1U << i)) != 0);
+		for (j=0; j<PAGE_SIZE; j++) {
+			if (mmaptest_buf[j] != want) {
+				kprintf("mmaptest: %s: page %u byte %u: "
+					"'%c', expected '%c'\n", what, i, j,
+					mmaptest_buf[j], want);
+				vfs_close(v);
+				return EINVAL;
+			}
+		}
+	}
+	vfs_close(v);
+	return 0;
+}
+
+/*
+ * Write page I of the mapping at VA through the mapping.
+ */
+static
+int
+mmaptest_dirty(vaddr_t va, unsigned i)
+{
+	mmaptest_fillbuf(mmaptest_byte(i, true));
+	return copyout(mmaptest_buf, (userptr_t)(va + i * PAGE_SIZE),
+		       PAGE_SIZE);
+}
+
+/*
+ * Make the file, and map it shared into AS, returning the address.
+ */
+static
+int
+mmaptest_map(struct addrspace *as, vaddr_t *va)
+{
+	char name[32];
+	struct vnode *v;
+	struct iovec iov;
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	strcpy(name, FILENAME);
+	result = vfs_open(name, O_RDWR|O_CREAT|O_TRUNC, 0664, &v);
+	if (result) {
+		kprintf("mmaptest: create: %s\n", strerror(result));
+		return result;
+	}
+	for (i=0; i<NPAGES; i++) {
+		mmaptest_fillbuf(mmaptest_byte(i, false));
+		uio_kinit(&iov, &ku, mmaptest_buf, PAGE_SIZE,
+			  (off_t)i * PAGE_SIZE, UIO_WRITE);
+		result = VOP_WRITE(v, &ku);
+		if (result) {
+			kprintf("mmaptest: write: %s\n", strerror(result));
+			vfs_close(v);
+			return result;
+		}
+	}
+
+	/* The mapping keeps its own reference to the file. */
+	*va = 0;
+	result = as_mmap(as, NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, v, 0, va);
+	vfs_close(v);
+	if (result) {
+		kprintf("mmaptest: as_mmap: %s\n", strerror(result));
+	}
+	return result;
+}
+
+/*
+ * Everything that's done with AS installed as the current one.
+ * Returns the pages written so far in *WRITTEN.
+ */
+static
+int
+mmaptest_run(struct addrspace *as, unsigned *written)
+{
+	vaddr_t va;
+	unsigned i;
+	int result;
+
+	result = mmaptest_map(as, &va);
+	if (result) {
+		return result;
+	}
+
+	/* Dirty the even pages; nothing reaches the file yet. */
+	for (i=0; i<NPAGES; i+=2) {
+		result = mmaptest_dirty(va, i);
+		if (result) {
+			kprintf("mmaptest: copyout: %s\n", strerror(result));
+			return result;
+		}
+		*written |= 1U << i;
+	}
+	result = mmaptest_checkfile("before munmap", 0);
+	if (result) {
+		return result;
+	}
+
+	/* Split the region; only the pages in the hole are written. */
+	result = as_munmap(as, va + HOLEPAGE * PAGE_SIZE,
+			   HOLEPAGES * PAGE_SIZE);
+	if (result) {
+		kprintf("mmaptest: as_munmap: %s\n", strerror(result));
+		return result;
+	}
+	result = mmaptest_checkfile("after munmap",
+		*written & (((1U << HOLEPAGES) - 1) << HOLEPAGE));
+	if (result) {
+		return result;
+	}
+
+	/* The upper piece still maps the right part of the file. */
+	i = NPAGES - 1;
+	result = mmaptest_dirty(va, i);
+	if (result) {
+		kprintf("mmaptest: copyout: %s\n", strerror(result));
+		return result;
+	}
+	*written |= 1U << i;
+	return 0;
+}
+
+int
+mmaptest(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	unsigned written;
+	char name[32];
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	as = as_create();
+	if (as == NULL) {
+		kprintf("mmaptest: as_create: out of memory\n");
+		return ENOMEM;
+	}
+	oldas = curproc_setas(as);
+	as_activate();
+
+	written = 0;
+	result = mmaptest_run(as, &written);
+
+	/* As in proc_exit: off the process first, then destroy it. */
+	as_deactivate();
+	as = curproc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+
+	if (result == 0) {
+		result = mmaptest_checkfile("after as_destroy", written);
+	}
+
+	strcpy(name, FILENAME);
+	vfs_remove(name);
+
+	if (result == 0) {
+		kprintf("mmaptest: passed\n");
+	}
+	return result;
+}
@@ -0,0 +1,1315 @@
+/*
+ * Address spaces.
+ *
+ * An address space is the list of regions that are valid, kept
+ * sorted by address so the fault handler can binary-search it, plus a
+ * page table holding whatever pages have actually been touched. Nothing is
+ * allocated or read when a region is defined; vm_fault creates each
+ * page on first use, reading it from the executable if it's part of a
+ * file-backed region.
+ */
+
+#define REGIONINLINE
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <synch.h>
+#include <wchan.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <vpage.h>
+#include <pagemerge.h>
+#include <shm.h>
+
+/* End (exclusive) of a region */
+#define RG_END(rg)	((rg)->rg_vbase + (rg)->rg_npages * PAGE_SIZE)
+
+static int as_regionio(struct region *rg, vaddr_t vaddr, paddr_t pa,
+		       enum uio_rw rw, bool *didio);
+
+/*
+ * Return the number of regions in AS that start at or below VADDR;
+ * the last of them (if any) is the only one that can contain it, as
+ * well as the only one that can contain a later region's first page.
+ */
+static
+unsigned
+as_search(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo, hi, mid;
+
+	lo = 0;
+	hi = regionarray_num(&as->as_regions);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (regionarray_get(&as->as_regions, mid)->rg_vbase <= vaddr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Insert RG in AS at position POS, keeping the array sorted.
+ */
+static
+int
+as_insertregion(struct addrspace *as, unsigned pos, struct region *rg)
+{
+	unsigned num, i;
+	int result;
+
+	num = regionarray_num(&as->as_regions);
+	result = regionarray_setsize(&as->as_regions, num + 1);
+	if (result) {
+		return result;
+	}
+	for (i=num; i>pos; i--) {
+		regionarray_set(&as->as_regions, i,
+				regionarray_get(&as->as_regions, i - 1));
+	}
+	regionarray_set(&as->as_regions, pos, rg);
+	return 0;
+}
+
+/*
+ * Free all AS's regions, dropping their files and shared memory
+ * segments. Their pages must already be gone.
+ */
+static
+void
+as_freeregions(struct addrspace *as)
+{
+	struct region *rg;
+	unsigned i, num;
+
+	num = regionarray_num(&as->as_regions);
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (rg->rg_vnode != NULL) {
+			vfs_close(rg->rg_vnode);
+		}
+		if (rg->rg_shm != NULL) {
+			shm_detach(rg->rg_shm);
+		}
+		kfree(rg);
+	}
+	regionarray_setsize(&as->as_regions, 0);
+}
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as;
+
+	as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL) {
+		return NULL;
+	}
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+	as->as_gatewchan = wchan_create("addrspace");
+	if (as->as_gatewchan == NULL) {
+		lock_destroy(as->as_lock);
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+	as->as_merging = false;
+	spinlock_init(&as->as_gatelock);
+	as->as_nfaults = 0;
+	as->as_scanning = false;
+	as->as_fabase = 0;
+	as->as_faloaded = 0;
+
+	regionarray_init(&as->as_regions);
+	as->as_stack = NULL;
+	as->as_stacklimit = VM_STACKPAGES;
+	as->as_heap = NULL;
+	as->as_heapbrk = 0;
+	as->as_asid = 0;
+	as->as_asidcpu = 0;
+
+	return as;
+}
+
+/*
+ * pt_foreach callback for as_copy: share one page with the new
+ * address space.
+ */
+static
+int
+as_copy_page(vaddr_t vaddr, struct vpage **slot, void *data)
+{
+	struct addrspace *new = data;
+	int result;
+
+	result = pt_insert(new->as_pt, vaddr, *slot);
+	if (result) {
+		return result;
+	}
+	vpage_incref(*slot);
+	return 0;
+}
+
+/*
+ * Make sure every page of the shared anonymous region RG exists, so
+ * that a fork shares all of it and not just what has been touched.
+ */
+static
+int
+as_fillshared(struct addrspace *as, struct region *rg)
+{
+	struct vpage *vp;
+	vaddr_t vaddr;
+	int result;
+
+	for (vaddr = rg->rg_vbase; vaddr < RG_END(rg); vaddr += PAGE_SIZE) {
+		if (pt_lookup(as->as_pt, vaddr) != NULL) {
+			continue;
+		}
+		vp = vpage_create();
+		if (vp == NULL) {
+			return ENOMEM;
+		}
+		vpage_unlock(vp);
+		result = pt_insert(as->as_pt, vaddr, vp);
+		if (result) {
+			vpage_decref(vp);
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The body of as_copy, called with OLD's lock held.
+ */
+static
+int
+as_docopy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	struct region *rg;
+	unsigned i, num;
+	int result;
+
+	new = as_create();
+	if (new == NULL) {
+		return ENOMEM;
+	}
+
+	num = regionarray_num(&old->as_regions);
+	result = regionarray_setsize(&new->as_regions, num);
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&old->as_regions, i);
+		if (rg->rg_shared && rg->rg_vnode == NULL) {
+			result = as_fillshared(old, rg);
+			if (result) {
+				regionarray_setsize(&new->as_regions, i);
+				as_destroy(new);
+				return result;
+			}
+		}
+
+		rg = kmalloc(sizeof(*rg));
+		if (rg == NULL) {
+			/* Drop the slots not yet filled in. */
+			regionarray_setsize(&new->as_regions, i);
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*rg = *regionarray_get(&old->as_regions, i);
+		if (rg->rg_vnode != NULL) {
+			VOP_INCOPEN(rg->rg_vnode);
+			VOP_INCREF(rg->rg_vnode);
+		}
+		if (rg->rg_shm != NULL) {
+			shm_incref(rg->rg_shm);
+		}
+		regionarray_set(&new->as_regions, i, rg);
+		if (regionarray_get(&old->as_regions, i) == old->as_stack) {
+			new->as_stack = rg;
+		}
+		if (regionarray_get(&old->as_regions, i) == old->as_heap) {
+			new->as_heap = rg;
+		}
+	}
+	new->as_stacklimit = old->as_stacklimit;
+	new->as_heapbrk = old->as_heapbrk;
+
+	/*
+	 * Share every page copy-on-write; vm_fault makes the copy when
+	 * either side first writes to one.
+	 */
+	result = pt_foreach(old->as_pt, 0, USERSPACETOP, as_copy_page, new);
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
+
+	/*
+	 * The old address space may have writable TLB entries for what
+	 * are now shared pages. Retire its ASID so they can't be used.
+	 */
+	tlb_forget(old);
+
+	*ret = new;
+	return 0;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	int result;
+
+	lock_acquire(old->as_lock);
+	result = as_docopy(old, ret);
+	lock_release(old->as_lock);
+	if (result) {
+		return result;
+	}
+
+	/* Not under OLD's lock: the merger takes its own lock first. */
+	pagemerge_register(*ret);
+	return 0;
+}
+
+/*
+ * pt_foreach callback for as_destroy: drop one page.
+ */
+static
+int
+as_destroy_page(vaddr_t vaddr, struct vpage **slot, void *data)
+{
+	(void)vaddr;
+	(void)data;
+
+	vpage_decref(*slot);
+	*slot = NULL;
+	return 0;
+}
+
+/*
+ * pt_foreach callback for as_writeback: write one page of the shared
+ * file region DATA back to the file if it has changed.
+ */
+static
+int
+as_writeback_page(vaddr_t vaddr, struct vpage **slot, void *data)
+{
+	struct region *rg = data;
+	struct vpage *vp = *slot;
+	bool didio;
+	int result;
+
+	vpage_lock(vp);
+	if (!vp->vp_modified) {
+		vpage_unlock(vp);
+		return 0;
+	}
+	result = vpage_pagein(vp);
+	if (result == 0) {
+		result = as_regionio(rg, vaddr, vp->vp_paddr, UIO_WRITE,
+				     &didio);
+	}
+	if (result == 0) {
+		/* Catch the next write, wherever the page is mapped. */
+		vp->vp_modified = false;
+		tlb_shootdown_paddr(vp->vp_paddr);
+	}
+	vpage_unlock(vp);
+	return result;
+}
+
+/*
+ * Write the changed pages of RG, a shared file region, between START
+ * and END back to its file.
+ */
+static
+int
+as_writeback(struct addrspace *as, struct region *rg,
+	     vaddr_t start, vaddr_t end)
+{
+	KASSERT(rg->rg_shared && rg->rg_vnode != NULL);
+	return pt_foreach(as->as_pt, start, end, as_writeback_page, rg);
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct region *rg;
+	unsigned i, num;
+	int result;
+
+	if (as->as_merging) {
+		pagemerge_unregister(as);
+	}
+
+	/* Shared file mappings are unmapped at exit, so update files. */
+	num = regionarray_num(&as->as_regions);
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (rg->rg_shared && rg->rg_vnode != NULL) {
+			result = as_writeback(as, rg, rg->rg_vbase,
+					      RG_END(rg));
+			if (result) {
+				kprintf("vm: Warning: mmap writeback: %s\n",
+					strerror(result));
+			}
+		}
+	}
+
+	/*
+	 * Pages first: text pages are only safe in the text cache
+	 * while whatever maps them still holds the file.
+	 */
+	pt_foreach(as->as_pt, 0, USERSPACETOP, as_destroy_page, NULL);
+	pt_destroy(as->as_pt);
+	as_freeregions(as);
+	regionarray_cleanup(&as->as_regions);
+	KASSERT(as->as_nfaults == 0);
+	spinlock_cleanup(&as->as_gatelock);
+	wchan_destroy(as->as_gatewchan);
+	lock_destroy(as->as_lock);
+	kfree(as);
+}
+
+void
+as_activate(void)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/* Kernel threads don't have an address space to activate */
+		return;
+	}
+
+	tlb_activate(as);
+}
+
+void
+as_deactivate(void)
+{
+	/* nothing */
+}
+
+/*
+ * Add a region of NPAGES pages at VADDR, which must be page-aligned,
+ * and return it in RET. NPAGES can be 0 (for the heap); the region
+ * then contains no addresses but still keeps others from starting at
+ * VADDR.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	     bool readable, bool writeable, bool executable,
+	     struct region **ret)
+{
+	struct region *rg, *prev, *next;
+	unsigned pos;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	/*
+	 * Find where it goes, and check it doesn't overlap its
+	 * neighbors by more than a shared boundary page.
+	 */
+	pos = as_search(as, vaddr);
+	if (pos > 0) {
+		prev = regionarray_get(&as->as_regions, pos - 1);
+		if (prev->rg_vbase == vaddr ||
+		    RG_END(prev) > vaddr + PAGE_SIZE) {
+			return EINVAL;
+		}
+	}
+	if (pos < regionarray_num(&as->as_regions)) {
+		next = regionarray_get(&as->as_regions, pos);
+		if (next->rg_vbase + PAGE_SIZE < vaddr + npages * PAGE_SIZE) {
+			return EINVAL;
+		}
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = npages;
+	/*
+	 * The MIPS can't tell reads from instruction fetches, or stop
+	 * reads of a writeable page, so what is enforced is writeable
+	 * and whether the region may be touched at all.
+	 */
+	rg->rg_readable = readable;
+	rg->rg_writeable = writeable;
+	rg->rg_executable = executable;
+	rg->rg_mmap = false;
+	rg->rg_shared = false;
+	rg->rg_vnode = NULL;
+	rg->rg_shm = NULL;
+	rg->rg_filevaddr = 0;
+	rg->rg_fileoffset = 0;
+	rg->rg_filesz = 0;
+
+	result = as_insertregion(as, pos, rg);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+	*ret = rg;
+	return 0;
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	struct region *rg;
+	vaddr_t stacklow;
+	size_t npages;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+
+	/* Leave room for the stack to grow all the way, plus its guard. */
+	stacklow = USERSTACK - (as->as_stacklimit + VM_STACKGUARD) * PAGE_SIZE;
+	if (vaddr >= stacklow || sz > stacklow - vaddr) {
+		return EFAULT;
+	}
+	if (npages == 0) {
+		return 0;
+	}
+
+	return as_addregion(as, vaddr, npages, readable != 0,
+			    writeable != 0, executable != 0, &rg);
+}
+
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned pos;
+
+	pos = as_search(as, vaddr);
+	if (pos == 0) {
+		return NULL;
+	}
+	rg = regionarray_get(&as->as_regions, pos - 1);
+	if (vaddr >= RG_END(rg)) {
+		return NULL;
+	}
+	return rg;
+}
+
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, size_t filesz,
+	       struct vnode *v, off_t offset)
+{
+	struct region *rg;
+
+	if (filesz == 0) {
+		/* Nothing to read */
+		return 0;
+	}
+
+	rg = as_findregion(as, vaddr);
+	if (rg == NULL || rg->rg_vnode != NULL) {
+		return EINVAL;
+	}
+	if (filesz > RG_END(rg) - vaddr) {
+		return EINVAL;
+	}
+
+	/* Our own reference, good until as_destroy. */
+	VOP_INCOPEN(v);
+	VOP_INCREF(v);
+
+	rg->rg_vnode = v;
+	rg->rg_filevaddr = vaddr;
+	rg->rg_fileoffset = offset;
+	rg->rg_filesz = filesz;
+	return 0;
+}
+
+/*
+ * Read or write the part of the page at VADDR, whose frame is PA,
+ * that belongs to RG's file, if any. Sets DIDIO if there was some.
+ */
+static
+int
+as_regionio(struct region *rg, vaddr_t vaddr, paddr_t pa, enum uio_rw rw,
+	    bool *didio)
+{
+	struct iovec iov;
+	struct uio u;
+	vaddr_t start, end;
+	int result;
+
+	if (rg->rg_vnode == NULL) {
+		return 0;
+	}
+
+	/* Intersect the page with the file data. */
+	start = rg->rg_filevaddr;
+	end = rg->rg_filevaddr + rg->rg_filesz;
+	if (start < vaddr) {
+		start = vaddr;
+	}
+	if (end > vaddr + PAGE_SIZE) {
+		end = vaddr + PAGE_SIZE;
+	}
+	if (start >= end) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &u, (void *)(PADDR_TO_KVADDR(pa) + (start - vaddr)),
+		  end - start, rg->rg_fileoffset + (start - rg->rg_filevaddr),
+		  rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(rg->rg_vnode, &u);
+	}
+	else {
+		result = VOP_WRITE(rg->rg_vnode, &u);
+	}
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		/* We checked the file was long enough when mapping it */
+		return EIO;
+	}
+	*didio = true;
+	return 0;
+}
+
+/*
+ * Find the regions the page at VADDR belongs to: the one containing
+ * it, and the one before that if it ends in the same page. Either may
+ * come back NULL.
+ */
+static
+void
+as_pageregions(struct addrspace *as, vaddr_t vaddr,
+	       struct region **rgret, struct region **prevret)
+{
+	struct region *rg;
+	unsigned pos;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	*rgret = NULL;
+	*prevret = NULL;
+
+	pos = as_search(as, vaddr);
+	if (pos == 0) {
+		return;
+	}
+	rg = regionarray_get(&as->as_regions, pos - 1);
+	if (vaddr < RG_END(rg)) {
+		*rgret = rg;
+	}
+	if (pos >= 2 && rg->rg_vbase == vaddr) {
+		rg = regionarray_get(&as->as_regions, pos - 2);
+		if (vaddr < RG_END(rg)) {
+			*prevret = rg;
+		}
+	}
+}
+
+int
+as_readpage(struct addrspace *as, vaddr_t vaddr, paddr_t pa, bool *fromfile)
+{
+	struct region *rg, *prev;
+	int result;
+
+	*fromfile = false;
+
+	as_pageregions(as, vaddr, &rg, &prev);
+	if (rg != NULL) {
+		result = as_regionio(rg, vaddr, pa, UIO_READ, fromfile);
+		if (result) {
+			return result;
+		}
+	}
+	if (prev != NULL) {
+		return as_regionio(prev, vaddr, pa, UIO_READ, fromfile);
+	}
+	return 0;
+}
+
+void
+as_pageaccess(struct addrspace *as, vaddr_t vaddr,
+	      bool *canread, bool *canwrite, bool *shared)
+{
+	struct region *rg, *prev;
+
+	*canread = *canwrite = *shared = false;
+
+	/* A page two segments share allows whatever either does. */
+	as_pageregions(as, vaddr, &rg, &prev);
+	if (rg != NULL) {
+		*canread = rg->rg_readable || rg->rg_writeable ||
+			rg->rg_executable;
+		*canwrite = rg->rg_writeable;
+		*shared = rg->rg_shared;
+	}
+	if (prev != NULL) {
+		*canread = *canread || prev->rg_readable ||
+			prev->rg_writeable || prev->rg_executable;
+		*canwrite = *canwrite || prev->rg_writeable;
+		/* Only ELF segments share pages, and they're private. */
+		KASSERT(!prev->rg_shared);
+	}
+}
+
+bool
+as_cachekey(struct addrspace *as, vaddr_t vaddr,
+	    struct vnode **v, off_t *offset, size_t *len)
+{
+	struct region *rg, *prev;
+	vaddr_t fileend;
+
+	as_pageregions(as, vaddr, &rg, &prev);
+	if (rg == NULL || prev != NULL) {
+		return false;
+	}
+	if (rg->rg_vnode == NULL) {
+		return false;
+	}
+	if (rg->rg_writeable && !rg->rg_shared) {
+		/* Each mapping needs its own copy */
+		return false;
+	}
+
+	/*
+	 * The file data has to start at or before the page, so that
+	 * the page is exactly LEN bytes of file followed by zeros.
+	 */
+	fileend = rg->rg_filevaddr + rg->rg_filesz;
+	if (rg->rg_filevaddr > vaddr || fileend <= vaddr) {
+		return false;
+	}
+
+	*v = rg->rg_vnode;
+	*offset = rg->rg_fileoffset + (vaddr - rg->rg_filevaddr);
+	*len = fileend - vaddr < PAGE_SIZE ? fileend - vaddr : PAGE_SIZE;
+	return true;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Pages are created on demand when the program touches them. */
+	(void)as;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	struct region *rg;
+	vaddr_t heapbase;
+	unsigned i, num;
+
+	KASSERT(as->as_heap == NULL);
+
+	/* The heap starts empty, just past the last segment. */
+	heapbase = 0;
+	num = regionarray_num(&as->as_regions);
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (RG_END(rg) > heapbase) {
+			heapbase = RG_END(rg);
+		}
+	}
+	as->as_heapbrk = heapbase;
+	return as_addregion(as, heapbase, 0, true, true, false, &as->as_heap);
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	int result;
+
+	KASSERT(as->as_stack == NULL);
+
+	/* One page to start with; vm_fault grows it as needed. */
+	result = as_addregion(as, USERSTACK - PAGE_SIZE, 1,
+			      true, true, false, &as->as_stack);
+	if (result) {
+		return result;
+	}
+
+	/* Loading is done; the page merger may look at it from now on. */
+	pagemerge_register(as);
+
+	/* Initial user-level stack pointer */
+	*stackptr = USERSTACK;
+	return 0;
+}
+
+/*
+ * Return true if VADDR lies in one of AS's regions.
+ */
+bool
+as_valid_addr(struct addrspace *as, vaddr_t vaddr)
+{
+	return as_findregion(as, vaddr) != NULL;
+}
+
+int
+as_growstack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack, *below;
+	vaddr_t low;
+	unsigned pos;
+
+	stack = as->as_stack;
+	if (stack == NULL || vaddr >= stack->rg_vbase) {
+		return EFAULT;
+	}
+	vaddr &= PAGE_FRAME;
+
+	/* No further than the limit... */
+	low = USERSTACK - as->as_stacklimit * PAGE_SIZE;
+
+	/* ...or the guard gap above whatever is below. */
+	pos = as_search(as, stack->rg_vbase);
+	KASSERT(pos > 0 && regionarray_get(&as->as_regions, pos - 1) == stack);
+	if (pos >= 2) {
+		below = regionarray_get(&as->as_regions, pos - 2);
+		if (RG_END(below) + VM_STACKGUARD * PAGE_SIZE > low) {
+			low = RG_END(below) + VM_STACKGUARD * PAGE_SIZE;
+		}
+	}
+
+	if (vaddr < low) {
+		return EFAULT;
+	}
+
+	/* Moving the base down doesn't change the sort order. */
+	stack->rg_npages += (stack->rg_vbase - vaddr) / PAGE_SIZE;
+	stack->rg_vbase = vaddr;
+	return 0;
+}
+
+/*
+ * The body of as_sbrk, called with AS's lock held.
+ */
+static
+int
+as_dosbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+	struct region *heap, *next;
+	vaddr_t newbrk, oldend, newend, limit;
+	unsigned pos;
+
+	heap = as->as_heap;
+	if (heap == NULL) {
+		return ENOSYS;
+	}
+
+	newbrk = as->as_heapbrk + amount;
+	if (amount < 0 ? newbrk > as->as_heapbrk : newbrk < as->as_heapbrk) {
+		/* wrapped around */
+		return amount < 0 ? EINVAL : ENOMEM;
+	}
+	if (newbrk < heap->rg_vbase) {
+		return EINVAL;
+	}
+
+	oldend = RG_END(heap);
+	newend = ROUNDUP(newbrk, PAGE_SIZE);
+
+	if (newend > oldend) {
+		/* Stay out of the next region, and the stack's guard. */
+		pos = as_search(as, heap->rg_vbase);
+		KASSERT(pos > 0);
+		KASSERT(regionarray_get(&as->as_regions, pos - 1) == heap);
+		if (pos < regionarray_num(&as->as_regions)) {
+			next = regionarray_get(&as->as_regions, pos);
+			limit = next->rg_vbase;
+			if (next == as->as_stack) {
+				limit -= VM_STACKGUARD * PAGE_SIZE;
+			}
+		}
+		else {
+			limit = USERSTACK;
+		}
+		if (newend > limit) {
+			return ENOMEM;
+		}
+	}
+	else if (newend < oldend) {
+		/*
+		 * Give back the pages past the new end. Any CPU may
+		 * still have them in its TLB, so retire our ASID too.
+		 */
+		pt_foreach(as->as_pt, newend, oldend, as_destroy_page, NULL);
+		tlb_forget(as);
+	}
+
+	heap->rg_npages = (newend - heap->rg_vbase) / PAGE_SIZE;
+	*oldbrk = as->as_heapbrk;
+	as->as_heapbrk = newbrk;
+	return 0;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_dosbrk(as, amount, oldbrk);
+	lock_release(as->as_lock);
+	return result;
+}
+
+/*
+ * Find room for NPAGES pages for mmap: the highest gap between
+ * regions below the stack's reservation and guard.
+ */
+static
+vaddr_t
+as_findgap(struct addrspace *as, size_t npages)
+{
+	struct region *rg;
+	vaddr_t top;
+	size_t sz;
+	unsigned i;
+
+	sz = npages * PAGE_SIZE;
+	top = USERSTACK - (as->as_stacklimit + VM_STACKGUARD) * PAGE_SIZE;
+
+	for (i = regionarray_num(&as->as_regions); i-- > 0; ) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (rg == as->as_stack || rg->rg_vbase >= top) {
+			continue;
+		}
+		if (RG_END(rg) <= top && top - RG_END(rg) >= sz) {
+			return top - sz;
+		}
+		top = rg->rg_vbase;
+	}
+
+	/* Below everything; don't use page 0. */
+	if (top >= sz + PAGE_SIZE) {
+		return top - sz;
+	}
+	return 0;
+}
+
+/*
+ * Choose where a new mapping of NPAGES pages goes: at *VADDR if
+ * FIXED, which must then be free, and otherwise wherever there's
+ * room, which is handed back in *VADDR.
+ */
+static
+int
+as_place(struct addrspace *as, size_t npages, bool fixed, vaddr_t *vaddr)
+{
+	vaddr_t stacklow;
+
+	if (!fixed) {
+		*vaddr = as_findgap(as, npages);
+		return *vaddr == 0 ? ENOMEM : 0;
+	}
+
+	stacklow = USERSTACK - (as->as_stacklimit + VM_STACKGUARD) * PAGE_SIZE;
+	if (*vaddr == 0 || (*vaddr & PAGE_FRAME) != *vaddr ||
+	    *vaddr >= stacklow || npages > (stacklow - *vaddr) / PAGE_SIZE) {
+		return EINVAL;
+	}
+	/* No sharing a boundary page here, unlike ELF segments. */
+	if (as_findregion(as, *vaddr) != NULL ||
+	    as_findregion(as, *vaddr + (npages - 1) * PAGE_SIZE) != NULL) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * The body of as_mmap, called with AS's lock held.
+ */
+static
+int
+as_domap(struct addrspace *as, size_t len, int prot, int flags,
+	 struct vnode *v, off_t offset, vaddr_t *addr)
+{
+	struct region *rg;
+	struct stat st;
+	vaddr_t vaddr;
+	size_t npages, filesz;
+	int result;
+
+	if (len == 0 || len > USERSTACK) {
+		return EINVAL;
+	}
+	if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+		return EINVAL;
+	}
+	if (offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+
+	/* How much of the mapping the file covers */
+	filesz = 0;
+	if (v != NULL) {
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
+		if (offset < st.st_size) {
+			filesz = st.st_size - offset < (off_t)len ?
+				st.st_size - offset : len;
+		}
+	}
+
+	vaddr = *addr;
+	result = as_place(as, npages, (flags & MAP_FIXED) != 0, &vaddr);
+	if (result) {
+		return result;
+	}
+
+	result = as_addregion(as, vaddr, npages, (prot & PROT_READ) != 0,
+			      (prot & PROT_WRITE) != 0,
+			      (prot & PROT_EXEC) != 0, &rg);
+	if (result) {
+		return result;
+	}
+	rg->rg_mmap = true;
+	rg->rg_shared = (flags & MAP_SHARED) != 0;
+	if (filesz > 0) {
+		/* Our own reference, good until the region goes away. */
+		VOP_INCOPEN(v);
+		VOP_INCREF(v);
+		rg->rg_vnode = v;
+		rg->rg_filevaddr = vaddr;
+		rg->rg_fileoffset = offset;
+		rg->rg_filesz = filesz;
+	}
+
+	*addr = vaddr;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, int prot, int flags,
+	struct vnode *v, off_t offset, vaddr_t *addr)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_domap(as, len, prot, flags, v, offset, addr);
+	lock_release(as->as_lock);
+	return result;
+}
+
+/*
+ * The body of as_munmap, called with AS's lock held.
+ */
+static
+int
+as_dounmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct region *rg, *rest;
+	vaddr_t end;
+	unsigned pos;
+	int result;
+
+	if ((addr & PAGE_FRAME) != addr || len == 0 || len > USERSTACK) {
+		return EINVAL;
+	}
+	end = addr + ROUNDUP(len, PAGE_SIZE);
+
+	pos = as_search(as, addr);
+	rg = as_findregion(as, addr);
+	if (rg == NULL || !rg->rg_mmap || end > RG_END(rg) || end < addr) {
+		return EINVAL;
+	}
+
+	/*
+	 * Unmapping the middle leaves two pieces; make the upper one
+	 * first, so running out of memory leaves everything as it was.
+	 */
+	rest = NULL;
+	if (addr > rg->rg_vbase && end < RG_END(rg)) {
+		rest = kmalloc(sizeof(*rest));
+		if (rest == NULL) {
+			return ENOMEM;
+		}
+		*rest = *rg;
+		rest->rg_vbase = end;
+		rest->rg_npages = (RG_END(rg) - end) / PAGE_SIZE;
+		result = as_insertregion(as, pos, rest);
+		if (result) {
+			kfree(rest);
+			return result;
+		}
+		if (rest->rg_vnode != NULL) {
+			VOP_INCOPEN(rest->rg_vnode);
+			VOP_INCREF(rest->rg_vnode);
+		}
+	}
+
+	if (rg->rg_shared && rg->rg_vnode != NULL) {
+		result = as_writeback(as, rg, addr, end);
+		if (result) {
+			/* Leave the mapping; the data is still there. */
+			if (rest != NULL) {
+				regionarray_remove(&as->as_regions, pos);
+				if (rest->rg_vnode != NULL) {
+					vfs_close(rest->rg_vnode);
+				}
+				kfree(rest);
+			}
+			return result;
+		}
+	}
+
+	/* Drop the pages, and any TLB entries for them on any CPU. */
+	pt_foreach(as->as_pt, addr, end, as_destroy_page, NULL);
+	tlb_forget(as);
+
+	if (rest != NULL) {
+		rg->rg_npages = (addr - rg->rg_vbase) / PAGE_SIZE;
+	}
+	else if (addr > rg->rg_vbase) {
+		/* Cut off the top */
+		rg->rg_npages = (addr - rg->rg_vbase) / PAGE_SIZE;
+	}
+	else if (end < RG_END(rg)) {
+		/* Cut off the bottom; the order doesn't change. */
+		rg->rg_npages = (RG_END(rg) - end) / PAGE_SIZE;
+		rg->rg_vbase = end;
+	}
+	else {
+		/* The whole thing */
+		KASSERT(regionarray_get(&as->as_regions, pos - 1) == rg);
+		regionarray_remove(&as->as_regions, pos - 1);
+		if (rg->rg_vnode != NULL) {
+			vfs_close(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_dounmap(as, addr, len);
+	lock_release(as->as_lock);
+	return result;
+}
+
+/*
+ * The body of as_shmat, called with AS's lock held.
+ */
+static
+int
+as_doshmat(struct addrspace *as, struct shmseg *seg, bool readonly,
+	   vaddr_t *addr)
+{
+	struct region *rg;
+	struct vpage *vp;
+	size_t npages;
+	unsigned i, pos;
+	int result;
+
+	npages = shm_npages(seg);
+	result = as_place(as, npages, *addr != 0, addr);
+	if (result) {
+		return result;
+	}
+	result = as_addregion(as, *addr, npages, true, !readonly, false, &rg);
+	if (result) {
+		return result;
+	}
+	rg->rg_shared = true;
+
+	/* Map all of it now; the segment already has every page. */
+	for (i=0; i<npages; i++) {
+		vp = shm_page(seg, i);
+		result = pt_insert(as->as_pt, *addr + i * PAGE_SIZE, vp);
+		if (result) {
+			pt_foreach(as->as_pt, *addr, *addr + i * PAGE_SIZE,
+				   as_destroy_page, NULL);
+			pos = as_search(as, *addr);
+			KASSERT(regionarray_get(&as->as_regions, pos - 1) == rg);
+			regionarray_remove(&as->as_regions, pos - 1);
+			kfree(rg);
+			return result;
+		}
+		vpage_incref(vp);
+	}
+	rg->rg_shm = seg;
+	return 0;
+}
+
+int
+as_shmat(struct addrspace *as, struct shmseg *seg, bool readonly,
+	 vaddr_t *addr)
+{
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_doshmat(as, seg, readonly, addr);
+	lock_release(as->as_lock);
+	return result;
+}
+
+int
+as_shmdt(struct addrspace *as, vaddr_t addr)
+{
+	struct region *rg;
+	unsigned pos;
+
+	lock_acquire(as->as_lock);
+
+	pos = as_search(as, addr);
+	rg = pos > 0 ? regionarray_get(&as->as_regions, pos - 1) : NULL;
+	if (rg == NULL || rg->rg_shm == NULL || rg->rg_vbase != addr) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	/* Drop the pages, and any TLB entries for them on any CPU. */
+	pt_foreach(as->as_pt, addr, RG_END(rg), as_destroy_page, NULL);
+	tlb_forget(as);
+	regionarray_remove(&as->as_regions, pos - 1);
+
+	lock_release(as->as_lock);
+
+	shm_detach(rg->rg_shm);
+	kfree(rg);
+	return 0;
+}
+
+/*
+ * pt_foreach callback for as_residentpages. DATA is the count.
+ */
+static
+int
+as_countresident(vaddr_t vaddr, struct vpage **slot, void *data)
+{
+	unsigned *count = data;
+
+	(void)vaddr;
+
+	/* Unlocked; it may be changing, but this is only a statistic. */
+	if ((*slot)->vp_paddr != 0) {
+		(*count)++;
+	}
+	return 0;
+}
+
+unsigned
+as_residentpages(struct addrspace *as)
+{
+	unsigned count = 0;
+
+	KASSERT(lock_do_i_hold(as->as_lock) || as->as_nfaults > 0);
+
+	pt_foreach(as->as_pt, 0, USERSPACETOP, as_countresident, &count);
+	return count;
+}
+
+bool
+as_faultbegin(struct addrspace *as)
+{
+	spinlock_acquire(&as->as_gatelock);
+	if (!as->as_scanning) {
+		as->as_nfaults++;
+		spinlock_release(&as->as_gatelock);
+		return false;
+	}
+	spinlock_release(&as->as_gatelock);
+
+	/* The merger is in; wait for it like anyone else. */
+	lock_acquire(as->as_lock);
+	return true;
+}
+
+void
+as_faultend(struct addrspace *as, bool locked)
+{
+	if (locked) {
+		lock_release(as->as_lock);
+		return;
+	}
+
+	spinlock_acquire(&as->as_gatelock);
+	KASSERT(as->as_nfaults > 0);
+	as->as_nfaults--;
+	if (as->as_nfaults == 0 && as->as_scanning) {
+		wchan_wakeall(as->as_gatewchan);
+	}
+	spinlock_release(&as->as_gatelock);
+}
+
+void
+as_scanbegin(struct addrspace *as)
+{
+	lock_acquire(as->as_lock);
+
+	spinlock_acquire(&as->as_gatelock);
+	as->as_scanning = true;
+	while (as->as_nfaults > 0) {
+		wchan_lock(as->as_gatewchan);
+		spinlock_release(&as->as_gatelock);
+		wchan_sleep(as->as_gatewchan);
+		spinlock_acquire(&as->as_gatelock);
+	}
+	spinlock_release(&as->as_gatelock);
+}
+
+void
+as_scanend(struct addrspace *as)
+{
+	spinlock_acquire(&as->as_gatelock);
+	as->as_scanning = false;
+	spinlock_release(&as->as_gatelock);
+
+	lock_release(as->as_lock);
+}
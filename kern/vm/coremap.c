@@ -0,0 +1,844 @@
+/*
+ * Coremap: physical page frame allocator.
+ *
+ * See coremap.h for an overview.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <vm.h>
+#include <coremap.h>
+#include "opt-dumbvm.h"
+#if !OPT_DUMBVM
+#include <vpage.h>
+#include <vmpolicy.h>
+#endif
+
+/* Frame states */
+#define CME_FREE	0	/* on a free list (unless pinned) */
+#define CME_FIXED	1	/* kernel memory; not reclaimable until freed */
+#define CME_USER	2	/* holds cme_page; may be evicted */
+
+/* Null link value for the free list */
+#define CME_NONE	((unsigned)-1)
+
+struct coremap_entry {
+	unsigned cme_state;	/* CME_FREE, CME_FIXED, or CME_USER */
+	unsigned cme_npages;	/* length of allocation (first frame only) */
+	unsigned cme_next;	/* free list links (frame numbers) */
+	unsigned cme_prev;
+	struct vpage *cme_page;	/* user page in this frame (CME_USER) */
+	void *cme_tag;		/* owner's tag (CME_FIXED; coremap_settag) */
+	bool cme_pinned;	/* reserved by an eviction in progress */
+	bool cme_zero;		/* known zero-filled (CME_FREE only) */
+};
+
+static struct coremap_entry *coremap;
+static unsigned coremap_nframes;	/* number of entries */
+static unsigned coremap_nfree;		/* number of free frames */
+static unsigned coremap_nzero;		/* how many of them are zeroed */
+static paddr_t coremap_base;		/* physical address of frame 0 */
+static unsigned coremap_freehead;	/* head of the free list */
+static unsigned coremap_zerohead;	/* head of the zeroed list */
+static bool coremap_ready;		/* set once bootstrap is done */
+#if !OPT_DUMBVM
+static const struct vmpolicy *coremap_policy;	/* replacement policy */
+#endif
+static bool coremap_zerosleeping;	/* zeroing thread wants a wakeup */
+
+/*
+ * Protects everything above. Also serializes ram_stealmem() before
+ * the coremap exists.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * The zeroing thread tries to keep COREMAP_ZEROTARGET frames on the
+ * zeroed list, and is woken when it drops below COREMAP_ZEROLOW.
+ */
+#define COREMAP_ZEROTARGET	64
+#define COREMAP_ZEROLOW		32
+
+static struct wchan *coremap_zerowchan;
+
+/*
+ * Frames ordinary allocations leave free, for coremap_alloc_reserve:
+ * the compressed page store needs to grow in the middle of evicting
+ * a page, when there is nothing left to evict.
+ */
+#if OPT_DUMBVM
+#define COREMAP_RESERVE		0
+#else
+#define COREMAP_RESERVE		4
+#endif
+
+#define FRAME_TO_PADDR(i)  (coremap_base + (paddr_t)(i) * PAGE_SIZE)
+#define PADDR_TO_FRAME(pa) (((pa) - coremap_base) / PAGE_SIZE)
+
+////////////////////////////////////////////////////////////
+//
+// Free lists
+//
+// Free frames are on one of two lists: the zeroed list if cme_zero
+// is set, and the free list otherwise. coremap_nfree counts both.
+
+static
+void
+freelist_push(unsigned i)
+{
+	struct coremap_entry *e = &coremap[i];
+	unsigned *head;
+
+	KASSERT(e->cme_state == CME_FREE);
+
+	head = e->cme_zero ? &coremap_zerohead : &coremap_freehead;
+	e->cme_prev = CME_NONE;
+	e->cme_next = *head;
+	if (*head != CME_NONE) {
+		coremap[*head].cme_prev = i;
+	}
+	*head = i;
+	coremap_nfree++;
+	if (e->cme_zero) {
+		coremap_nzero++;
+	}
+}
+
+static
+void
+freelist_unlink(unsigned i)
+{
+	struct coremap_entry *e = &coremap[i];
+	unsigned *head;
+
+	KASSERT(e->cme_state == CME_FREE);
+	KASSERT(coremap_nfree > 0);
+
+	head = e->cme_zero ? &coremap_zerohead : &coremap_freehead;
+	if (e->cme_prev != CME_NONE) {
+		coremap[e->cme_prev].cme_next = e->cme_next;
+	}
+	else {
+		KASSERT(*head == i);
+		*head = e->cme_next;
+	}
+	if (e->cme_next != CME_NONE) {
+		coremap[e->cme_next].cme_prev = e->cme_prev;
+	}
+	e->cme_next = e->cme_prev = CME_NONE;
+	coremap_nfree--;
+	if (e->cme_zero) {
+		KASSERT(coremap_nzero > 0);
+		coremap_nzero--;
+	}
+}
+
+/*
+ * Decide whether the zeroing thread needs waking, and if so mark it
+ * awake; the caller wakes it after dropping the coremap lock.
+ */
+static
+bool
+coremap_zerowanted(void)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (coremap_zerosleeping && coremap_nzero < COREMAP_ZEROLOW &&
+	    coremap_freehead != CME_NONE) {
+		coremap_zerosleeping = false;
+		return true;
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Bootstrap
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	unsigned i, nframes, cmpages;
+
+	KASSERT(!coremap_ready);
+
+	ram_getsize(&lo, &hi);
+	KASSERT((lo & PAGE_FRAME) == lo);
+	KASSERT((hi & PAGE_FRAME) == hi);
+
+	/*
+	 * The coremap goes at the bottom of the memory we were given
+	 * and describes all of it, including the pages it occupies
+	 * itself; those are marked permanently in use.
+	 */
+	nframes = (hi - lo) / PAGE_SIZE;
+	cmpages = DIVROUNDUP(nframes * sizeof(struct coremap_entry),
+			     PAGE_SIZE);
+	if (cmpages >= nframes) {
+		panic("coremap: not enough memory for the coremap\n");
+	}
+
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(lo);
+	coremap_nframes = nframes;
+	coremap_base = lo;
+	coremap_nfree = 0;
+	coremap_nzero = 0;
+	coremap_freehead = CME_NONE;
+	coremap_zerohead = CME_NONE;
+
+	for (i=0; i<cmpages; i++) {
+		coremap[i].cme_state = CME_FIXED;
+		coremap[i].cme_npages = (i == 0) ? cmpages : 0;
+		coremap[i].cme_next = coremap[i].cme_prev = CME_NONE;
+		coremap[i].cme_page = NULL;
+		coremap[i].cme_tag = NULL;
+		coremap[i].cme_pinned = false;
+		coremap[i].cme_zero = false;
+	}
+
+	/*
+	 * Push in descending order so single-page allocations come
+	 * from the bottom and the top stays contiguous for as long as
+	 * possible.
+	 */
+	for (i=nframes; i-- > cmpages; ) {
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_page = NULL;
+		coremap[i].cme_tag = NULL;
+		coremap[i].cme_pinned = false;
+		coremap[i].cme_zero = false;
+		freelist_push(i);
+	}
+
+	spinlock_acquire(&coremap_lock);
+	coremap_ready = true;
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %u frames (%uk), %u used by the coremap\n",
+		nframes, nframes * PAGE_SIZE / 1024, cmpages);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Allocation
+
+/*
+ * Find a run of NPAGES free frames. First fit, from the top down, so
+ * as to stay away from the frames handed out one at a time.
+ */
+static
+unsigned
+coremap_findrun(unsigned long npages)
+{
+	unsigned i, run;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	run = 0;
+	for (i=coremap_nframes; i-- > 0; ) {
+		if (coremap[i].cme_state != CME_FREE || coremap[i].cme_pinned) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run == npages) {
+			return i;
+		}
+	}
+	return CME_NONE;
+}
+
+/*
+ * Take NPAGES free frames off the free lists, if possible, and mark
+ * them allocated in state STATE. A single frame comes from the zeroed
+ * list if WANTZERO is set, and otherwise preferably not, so as to
+ * save the zeroed frames for those who need them. The last
+ * COREMAP_RESERVE frames are only handed out if RESERVE is set.
+ * Returns the first frame, or CME_NONE, and sets *ZEROED if it is a
+ * single frame that was already zero-filled.
+ */
+static
+unsigned
+coremap_takefree(unsigned long npages, unsigned state, bool wantzero,
+		 bool reserve, bool *zeroed)
+{
+	unsigned i, first;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	*zeroed = false;
+	if (npages + (reserve ? 0 : COREMAP_RESERVE) > coremap_nfree) {
+		return CME_NONE;
+	}
+
+	if (npages == 1) {
+		if (wantzero) {
+			first = coremap_zerohead != CME_NONE ?
+				coremap_zerohead : coremap_freehead;
+		}
+		else {
+			first = coremap_freehead != CME_NONE ?
+				coremap_freehead : coremap_zerohead;
+		}
+		KASSERT(first != CME_NONE);
+		*zeroed = coremap[first].cme_zero;
+	}
+	else {
+		first = coremap_findrun(npages);
+		if (first == CME_NONE) {
+			return CME_NONE;
+		}
+	}
+
+	for (i=first; i<first+npages; i++) {
+		freelist_unlink(i);
+		coremap[i].cme_state = state;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_zero = false;
+	}
+	coremap[first].cme_npages = npages;
+	return first;
+}
+
+#if OPT_DUMBVM
+
+/* No paging under dumbvm. */
+static
+unsigned
+coremap_reclaim(unsigned long npages)
+{
+	(void)npages;
+	return CME_NONE;
+}
+
+#else /* !OPT_DUMBVM */
+
+/*
+ * Eviction.
+ *
+ * Frames chosen for eviction are pinned, which keeps every other
+ * allocator and the clock away from them, and the pages in them are
+ * locked with vpage_trylock. (Never vpage_lock: the thread that holds
+ * a page locked may itself be in here waiting for memory.) Then the
+ * coremap lock is dropped while the pages are written out.
+ *
+ * Nobody else can free a frame while we have it, because freeing a
+ * user frame requires holding its page locked.
+ */
+
+/*
+ * Helpers for the replacement policy; see vmpolicy.h.
+ */
+bool
+coremap_lockframe(unsigned frame)
+{
+	struct coremap_entry *e;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(frame < coremap_nframes);
+
+	e = &coremap[frame];
+	if (e->cme_state != CME_USER || e->cme_pinned) {
+		return false;
+	}
+	return vpage_trylock(e->cme_page);
+}
+
+void
+coremap_unlockframe(unsigned frame)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap[frame].cme_state == CME_USER);
+
+	vpage_unlock(coremap[frame].cme_page);
+}
+
+bool
+coremap_testclearref(unsigned frame)
+{
+	struct vpage *vp;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap[frame].cme_state == CME_USER);
+
+	vp = coremap[frame].cme_page;
+	KASSERT(vp->vp_busy);
+	if (!vp->vp_referenced) {
+		return false;
+	}
+	vp->vp_referenced = false;
+	/*
+	 * Only this CPU's TLB entries go: we hold the coremap lock, so
+	 * can't wait for the others, and all that's lost by leaving
+	 * theirs is some reference tracking.
+	 */
+	tlb_invalidate_paddr(FRAME_TO_PADDR(frame));
+	return true;
+}
+
+void
+coremap_setpolicy(const struct vmpolicy *policy)
+{
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+	coremap_policy = policy;
+	policy->vmp_reset();
+	for (i=0; i<coremap_nframes; i++) {
+		if (coremap[i].cme_state == CME_USER) {
+			policy->vmp_add(i);
+		}
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Pick one frame to evict, using the replacement policy. Returns it
+ * pinned and its page locked, or CME_NONE if every user page is busy
+ * or there are none.
+ */
+static
+unsigned
+coremap_choose(void)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (coremap_policy == NULL) {
+		return CME_NONE;
+	}
+	i = coremap_policy->vmp_choose();
+	if (i == VMPOLICY_NONE) {
+		return CME_NONE;
+	}
+	KASSERT(coremap[i].cme_state == CME_USER);
+	KASSERT(coremap[i].cme_page->vp_busy);
+	coremap[i].cme_pinned = true;
+	return i;
+}
+
+/*
+ * Can frame I be made part of a multi-page run?
+ */
+static
+bool
+coremap_reclaimable(unsigned i)
+{
+	struct coremap_entry *e = &coremap[i];
+
+	if (e->cme_pinned) {
+		return false;
+	}
+	return e->cme_state == CME_FREE || e->cme_state == CME_USER;
+}
+
+/*
+ * Find a run of NPAGES frames that are free or hold user pages that
+ * can be locked, for a multi-page kernel allocation. Returns the
+ * first frame with the whole run pinned, the free frames in it off
+ * the free list, and the user pages in it locked; or CME_NONE.
+ */
+static
+unsigned
+coremap_findvictims(unsigned long npages)
+{
+	unsigned i, j, k, run;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	run = 0;
+	for (i=coremap_nframes; i-- > 0; ) {
+		if (!coremap_reclaimable(i)) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run < npages) {
+			continue;
+		}
+
+		/* Candidate run is [i, i+npages). Lock its pages. */
+		for (j=i; j<i+npages; j++) {
+			if (coremap[j].cme_state == CME_USER &&
+			    !vpage_trylock(coremap[j].cme_page)) {
+				break;
+			}
+		}
+		if (j == i+npages) {
+			for (k=i; k<i+npages; k++) {
+				if (coremap[k].cme_state == CME_FREE) {
+					/* (cme_zero stays, for unpin) */
+					freelist_unlink(k);
+				}
+				coremap[k].cme_pinned = true;
+			}
+			return i;
+		}
+
+		/* Frame J is busy; back off and keep looking below it. */
+		for (k=i; k<j; k++) {
+			if (coremap[k].cme_state == CME_USER) {
+				vpage_unlock(coremap[k].cme_page);
+			}
+		}
+		run = j - i;
+	}
+	return CME_NONE;
+}
+
+/*
+ * Give back frames pinned by coremap_findvictims or coremap_choose
+ * after an eviction failed partway: frames already emptied go on the
+ * free list, and those still holding pages are unlocked.
+ */
+static
+void
+coremap_unpin(unsigned first, unsigned long npages)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i=first; i<first+npages; i++) {
+		KASSERT(coremap[i].cme_pinned);
+		coremap[i].cme_pinned = false;
+		if (coremap[i].cme_state == CME_FREE) {
+			freelist_push(i);
+		}
+		else {
+			KASSERT(coremap[i].cme_state == CME_USER);
+			vpage_unlock(coremap[i].cme_page);
+		}
+	}
+}
+
+/*
+ * Evict pages to obtain a run of NPAGES frames. Returns the first
+ * frame, with the run still pinned and in state CME_FREE but off the
+ * free list; or CME_NONE. Called without the coremap lock; may sleep.
+ */
+static
+unsigned
+coremap_reclaim(unsigned long npages)
+{
+	struct vpage *vp;
+	unsigned i, first;
+	int result;
+
+	if (curthread->t_in_interrupt || curthread->t_curspl != 0) {
+		/* Can't do I/O from here. */
+		return CME_NONE;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	if (npages == 1) {
+		first = coremap_choose();
+	}
+	else {
+		first = coremap_findvictims(npages);
+	}
+	spinlock_release(&coremap_lock);
+
+	if (first == CME_NONE) {
+		return CME_NONE;
+	}
+
+	for (i=first; i<first+npages; i++) {
+		/* Only we touch pinned entries; no need to lock to look. */
+		if (coremap[i].cme_state != CME_USER) {
+			continue;
+		}
+		vp = coremap[i].cme_page;
+		KASSERT(vp->vp_paddr == FRAME_TO_PADDR(i));
+
+		result = vpage_evict(vp);
+
+		spinlock_acquire(&coremap_lock);
+		if (result) {
+			coremap_unpin(first, npages);
+			spinlock_release(&coremap_lock);
+			return CME_NONE;
+		}
+		if (coremap_policy != NULL) {
+			coremap_policy->vmp_remove(i);
+		}
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_page = NULL;
+		spinlock_release(&coremap_lock);
+
+		vpage_unlock(vp);
+	}
+	return first;
+}
+
+#endif /* OPT_DUMBVM */
+
+/*
+ * Common code for coremap_alloc and coremap_alloc_user. If ZERO is
+ * set, the frames are returned zero-filled.
+ */
+static
+paddr_t
+coremap_getframes(unsigned long npages, unsigned state, struct vpage *vp,
+		  bool zero)
+{
+	unsigned i, first;
+	paddr_t pa;
+	bool zeroed, wake;
+
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (!coremap_ready) {
+		KASSERT(state == CME_FIXED);
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		if (pa != 0 && zero) {
+			bzero((void *)PADDR_TO_KVADDR(pa), npages * PAGE_SIZE);
+		}
+		return pa;
+	}
+
+	first = coremap_takefree(npages, state, zero, false, &zeroed);
+	if (first == CME_NONE) {
+		spinlock_release(&coremap_lock);
+
+		/* Out of free memory; try paging something out. */
+		first = coremap_reclaim(npages);
+		if (first == CME_NONE) {
+			return 0;
+		}
+
+		spinlock_acquire(&coremap_lock);
+		for (i=first; i<first+npages; i++) {
+			KASSERT(coremap[i].cme_state == CME_FREE);
+			KASSERT(coremap[i].cme_pinned);
+			coremap[i].cme_state = state;
+			coremap[i].cme_npages = 0;
+			coremap[i].cme_pinned = false;
+			coremap[i].cme_zero = false;
+		}
+		coremap[first].cme_npages = npages;
+		zeroed = false;
+	}
+
+	coremap[first].cme_page = vp;
+#if !OPT_DUMBVM
+	if (state == CME_USER && coremap_policy != NULL) {
+		coremap_policy->vmp_add(first);
+	}
+#endif
+	wake = zeroed && coremap_zerowanted();
+
+	spinlock_release(&coremap_lock);
+
+	if (wake) {
+		wchan_wakeone(coremap_zerowchan);
+	}
+	pa = FRAME_TO_PADDR(first);
+	if (zero && !zeroed) {
+		bzero((void *)PADDR_TO_KVADDR(pa), npages * PAGE_SIZE);
+	}
+	return pa;
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	return coremap_getframes(npages, CME_FIXED, NULL, false);
+}
+
+paddr_t
+coremap_alloc_user(struct vpage *vp, bool zero)
+{
+	KASSERT(vp != NULL);
+	return coremap_getframes(1, CME_USER, vp, zero);
+}
+
+paddr_t
+coremap_alloc_reserve(void)
+{
+	unsigned first;
+	bool zeroed;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_ready);
+	first = coremap_takefree(1, CME_FIXED, false, true, &zeroed);
+	spinlock_release(&coremap_lock);
+
+	if (first == CME_NONE) {
+		return 0;
+	}
+	return FRAME_TO_PADDR(first);
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned i, first, npages;
+	bool wake;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (!coremap_ready || paddr < coremap_base) {
+		/* Stolen before the coremap existed; leak it. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	first = PADDR_TO_FRAME(paddr);
+	KASSERT(first < coremap_nframes);
+	KASSERT(coremap[first].cme_state != CME_FREE);
+	KASSERT(!coremap[first].cme_pinned);
+
+	npages = coremap[first].cme_npages;
+	if (npages == 0) {
+		panic("coremap_free: 0x%x is not the start of an allocation\n",
+		      paddr);
+	}
+	KASSERT(first + npages <= coremap_nframes);
+
+#if !OPT_DUMBVM
+	if (coremap[first].cme_state == CME_USER && coremap_policy != NULL) {
+		coremap_policy->vmp_remove(first);
+	}
+#endif
+
+	for (i=first; i<first+npages; i++) {
+		KASSERT(coremap[i].cme_state == coremap[first].cme_state);
+		KASSERT(i == first || coremap[i].cme_npages == 0);
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_page = NULL;
+		coremap[i].cme_tag = NULL;
+		coremap[i].cme_zero = false;
+		freelist_push(i);
+	}
+	wake = coremap_zerowanted();
+
+	spinlock_release(&coremap_lock);
+
+	if (wake) {
+		wchan_wakeone(coremap_zerowchan);
+	}
+}
+
+bool
+coremap_settag(paddr_t paddr, void *tag)
+{
+	unsigned i;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	if (!coremap_ready || paddr < coremap_base) {
+		return false;
+	}
+	i = PADDR_TO_FRAME(paddr);
+	KASSERT(i < coremap_nframes);
+	KASSERT(coremap[i].cme_state == CME_FIXED);
+
+	/* The frame is the caller's, so nothing else writes this. */
+	coremap[i].cme_tag = tag;
+	return true;
+}
+
+bool
+coremap_gettag(paddr_t paddr, void **tag)
+{
+	unsigned i;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	if (!coremap_ready || paddr < coremap_base) {
+		return false;
+	}
+	i = PADDR_TO_FRAME(paddr);
+	KASSERT(i < coremap_nframes);
+	*tag = coremap[i].cme_tag;
+	return true;
+}
+
+void
+coremap_getstats(unsigned *used, unsigned *total)
+{
+	spinlock_acquire(&coremap_lock);
+	*total = coremap_nframes;
+	*used = coremap_nframes - coremap_nfree;
+	spinlock_release(&coremap_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Zeroing
+
+/*
+ * Zeroing thread: take frames off the free list one at a time, clear
+ * them with the coremap lock released, and put them on the zeroed
+ * list. The frame being cleared is pinned and on neither list, so
+ * nothing else will hand it out. After each frame, yield, so that
+ * this only gets the time nothing else wants.
+ */
+static
+void
+coremap_zerothread(void *data1, unsigned long data2)
+{
+	unsigned i;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&coremap_lock);
+		while (coremap_nzero >= COREMAP_ZEROTARGET ||
+		       coremap_freehead == CME_NONE) {
+			coremap_zerosleeping = true;
+			/* Bridge to the wchan lock; wchan_sleep unlocks it. */
+			wchan_lock(coremap_zerowchan);
+			spinlock_release(&coremap_lock);
+			wchan_sleep(coremap_zerowchan);
+			spinlock_acquire(&coremap_lock);
+		}
+		i = coremap_freehead;
+		freelist_unlink(i);
+		coremap[i].cme_pinned = true;
+		spinlock_release(&coremap_lock);
+
+		bzero((void *)PADDR_TO_KVADDR(FRAME_TO_PADDR(i)), PAGE_SIZE);
+
+		spinlock_acquire(&coremap_lock);
+		coremap[i].cme_pinned = false;
+		coremap[i].cme_zero = true;
+		freelist_push(i);
+		spinlock_release(&coremap_lock);
+
+		thread_yield();
+	}
+}
+
+void
+coremap_startzeroing(void)
+{
+	int result;
+
+	KASSERT(coremap_ready);
+
+	coremap_zerowchan = wchan_create("coremap zero");
+	if (coremap_zerowchan == NULL) {
+		panic("coremap_startzeroing: out of memory\n");
+	}
+	result = thread_fork("pagezero", NULL, coremap_zerothread, NULL, 0);
+	if (result) {
+		panic("coremap_startzeroing: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
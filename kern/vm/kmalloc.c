@@ -30,7 +30,15 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
 #include <vm.h>
+#include <coremap.h>
+#include <kmem_cache.h>
+#include <kmprof.h>
+#include "opt-kmprof.h"
 
 /*
  * Kernel malloc.
@@ -89,6 +97,9 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #define SMALLEST_SUBPAGE_SIZE 16
 #define LARGEST_SUBPAGE_SIZE 2048
 
+/* Largest per-cpu magazine (see magsizes[]) */
+#define KM_MAGMAX 16
+
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
 #else
@@ -101,9 +112,17 @@ struct freelist {
 	struct freelist *next;
 };
 
+/*
+ * Each pageref is on two doubly-linked lists, one of the pages of its
+ * size and one of all pages, so it can be taken off them in constant
+ * time. The pprev fields point at whatever points at this pageref:
+ * the list head or the previous pageref's next field.
+ */
 struct pageref {
 	struct pageref *next_samesize;
+	struct pageref **pprev_samesize;
 	struct pageref *next_all;
+	struct pageref **pprev_all;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -118,84 +137,112 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
+ * Pagerefs are allocated a page at a time. The first page of them is
+ * in the kernel BSS, so none has to be allocated to get started; it
+ * covers 170 * 4k = 680k of kernel heap. When those run out, subpage
+ * allocation gets another page of them from alloc_kpages, so the
+ * subpage heap can grow as far as memory allows. Pages of pagerefs
+ * are never given back, but their pagerefs are reused.
  *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
+ * Unused pagerefs are kept on a list threaded through next_samesize,
+ * so getting and releasing one takes constant time. An unused
+ * pageref has pageaddr_and_blocktype 0, which no page address is.
  *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * These are called with kmalloc_spinlock held.
  */
 
 #define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
 static struct pageref pagerefs[NPAGEREFS];
+static bool pagerefs_used;		/* pagerefs[] is on the list */
+
+static struct pageref *pageref_freelist;
+static unsigned pagerefs_total;		/* in use or not */
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
+static
+void
+addpagerefs(struct pageref *prs, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		prs[i].pageaddr_and_blocktype = 0;
+		prs[i].next_samesize = pageref_freelist;
+		pageref_freelist = &prs[i];
+	}
+	pagerefs_total += n;
+}
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
+	struct pageref *p;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
-		}
-		KASSERT(0);
+	if (pageref_freelist == NULL && !pagerefs_used) {
+		pagerefs_used = true;
+		addpagerefs(pagerefs, NPAGEREFS);
 	}
 
-	/* ran out */
-	return NULL;
+	p = pageref_freelist;
+	if (p == NULL) {
+		/* ran out */
+		return NULL;
+	}
+	KASSERT(p->pageaddr_and_blocktype == 0);
+	pageref_freelist = p->next_samesize;
+	return p;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	uint32_t k;
-
-	j = p-pagerefs;
-	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	KASSERT(p->pageaddr_and_blocktype != 0);
+	p->pageaddr_and_blocktype = 0;
+	p->next_samesize = pageref_freelist;
+	pageref_freelist = p;
 }
 
 ////////////////////////////////////////
 
+/*
+ * Pages in use, by size and all together. Pages kfree can find the
+ * pageref of through the coremap tag are on allbase; those from
+ * before the coremap, which can't be tagged, are on earlybase and
+ * have to be searched for. There are only ever a few of those.
+ */
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
+static struct pageref *earlybase;
 
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages. Most kmallocs and kfrees don't get
+ * this far, being served from per-cpu magazines (see below) instead.
+ *
+ * kmalloc_lock counts how often the lock is taken, and how often
+ * someone else already had it, for kheap_printstats; the counts are
+ * only changed with the lock held.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static unsigned kmalloc_nlocks;
+static unsigned kmalloc_ncontended;
+
+static
+void
+kmalloc_lock(void)
+{
+	bool busy;
+
+	busy = spinlock_data_get(&kmalloc_spinlock.lk_lock) != 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_nlocks++;
+	if (busy) {
+		kmalloc_ncontended++;
+	}
+}
 
 ////////////////////////////////////////
 
@@ -260,14 +307,19 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
+			KASSERT(sc < pagerefs_total);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
+		KASSERT(ac < pagerefs_total);
+		ac++;
+	}
+	for (pr = earlybase; pr != NULL; pr = pr->next_all) {
+		checksubpage(pr);
+		KASSERT(ac < pagerefs_total);
 		ac++;
 	}
 
@@ -330,47 +382,45 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+////////////////////////////////////////
+
+static
 void
-kheap_printstats(void)
+add_lists(struct pageref *pr, int blktype, struct pageref **allhead)
 {
-	struct pageref *pr;
-
-	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
-
-	kprintf("Subpage allocator status:\n");
+	KASSERT(blktype>=0 && blktype<NSIZES);
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+	pr->next_samesize = sizebases[blktype];
+	pr->pprev_samesize = &sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = &pr->next_samesize;
 	}
+	sizebases[blktype] = pr;
 
-	spinlock_release(&kmalloc_spinlock);
+	pr->next_all = *allhead;
+	pr->pprev_all = allhead;
+	if (pr->next_all != NULL) {
+		pr->next_all->pprev_all = &pr->next_all;
+	}
+	*allhead = pr;
 }
 
-////////////////////////////////////////
-
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+remove_lists(struct pageref *pr)
 {
-	struct pageref **guy;
-
-	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	KASSERT(*pr->pprev_samesize == pr);
+	*pr->pprev_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = pr->pprev_samesize;
 	}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+	KASSERT(*pr->pprev_all == pr);
+	*pr->pprev_all = pr->next_all;
+	if (pr->next_all != NULL) {
+		pr->next_all->pprev_all = pr->pprev_all;
 	}
 }
 
@@ -392,88 +442,92 @@ int blocktype(size_t sz)
 	return 0;
 }
 
+/*
+ * Take one block off the freelist of PR, which has one.
+ */
 static
 void *
-subpage_kmalloc(size_t sz)
+subpage_take(struct pageref *pr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
+	struct freelist *fl;	// free list entry
 	void *retptr;		// our result
 
-	volatile int i;
-
-
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
-
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
-
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
-
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-			checksubpages();
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
 	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return retptr;
+}
 
-	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
-	 * We release the spinlock while calling alloc_kpages. This
-	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
-	 */
+/*
+ * No page of the right size available.
+ * Make a new one.
+ *
+ * We release the spinlock while calling alloc_kpages. This
+ * avoids deadlock if alloc_kpages needs to come back here.
+ * Note that this means things can change behind our back...
+ *
+ * Called and returns with the spinlock held.
+ */
+static
+struct pageref *
+subpage_newpage(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for the new page
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t refpage;	// more pagerefs, if needed
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+
+	volatile int i;
 
 	spinlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
+		kmalloc_lock();
 		return NULL;
 	}
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 
 	pr = allocpageref();
+	if (pr==NULL) {
+		/* Out of pagerefs; get another page of them. */
+		spinlock_release(&kmalloc_spinlock);
+		refpage = alloc_kpages(1);
+		kmalloc_lock();
+		if (refpage != 0) {
+			addpagerefs((struct pageref *)refpage, NPAGEREFS);
+		}
+		pr = allocpageref();
+	}
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+		kmalloc_lock();
 		return NULL;
 	}
 
@@ -498,35 +552,81 @@ subpage_kmalloc(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
+	/* So kfree can find the pageref without searching. */
+	if (coremap_settag(KVADDR_TO_PADDR(prpage), pr)) {
+		add_lists(pr, blktype, &allbase);
+	}
+	else {
+		add_lists(pr, blktype, &earlybase);
+	}
+
+	return pr;
+}
+
+/*
+ * Get up to N blocks of size sizes[BLKTYPE] into BLOCKS, with one
+ * acquisition of the lock, and return how many. A new page is only
+ * made if there are no free blocks at all; 0 means out of memory.
+ */
+static
+unsigned
+subpage_getblocks(unsigned blktype, void **blocks, unsigned n)
+{
+	struct pageref *pr;	// pageref for page we're allocating from
+	unsigned got = 0;
+
+	kmalloc_lock();
 
-	pr->next_all = allbase;
-	allbase = pr;
+	checksubpages();
+
+	for (pr = sizebases[blktype]; pr != NULL && got < n;
+	     pr = pr->next_samesize) {
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+
+		while (pr->nfree > 0 && got < n) {
+			blocks[got++] = subpage_take(pr);
+		}
+	}
+
+	if (got == 0) {
+		pr = subpage_newpage(blktype);
+		while (pr != NULL && pr->nfree > 0 && got < n) {
+			blocks[got++] = subpage_take(pr);
+		}
+	}
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+	return got;
 }
 
+/*
+ * Find the pageref for the page containing PTRADDR, or NULL if it
+ * isn't one of ours. This is the page's coremap tag, unless the page
+ * predates the coremap.
+ */
 static
-int
-subpage_kfree(void *ptr)
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
-
-	ptraddr = (vaddr_t)ptr;
+	int blktype;		// index into sizes[] that we're using
+	void *tag;
 
-	spinlock_acquire(&kmalloc_spinlock);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	checksubpages();
+	if (coremap_gettag(KVADDR_TO_PADDR(ptraddr & PAGE_FRAME), &tag)) {
+		pr = tag;
+		KASSERT(pr == NULL || PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME));
+		return pr;
+	}
 
-	for (pr = allbase; pr; pr = pr->next_all) {
+	for (pr = earlybase; pr; pr = pr->next_all) {
 		prpage = PR_PAGEADDR(pr);
 		blktype = PR_BLOCKTYPE(pr);
 
@@ -535,29 +635,39 @@ subpage_kfree(void *ptr)
 		checksubpage(pr);
 
 		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+			return pr;
 		}
 	}
+	return NULL;
+}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+/*
+ * Put the block PTR back on the freelist of its page PR. If that
+ * makes the whole page free, take it off the lists and return its
+ * address, for the caller to free_kpages once the lock is released;
+ * otherwise return 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
 
-	offset = ptraddr - prpage;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = (vaddr_t)ptr - prpage;
 
 	/* Check for proper positioning and alignment */
 	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
-	/*
-	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
-	 */
-	fill_deadbeef(ptr, sizes[blktype]);
-
 	/*
 	 * We probably ought to check for free twice by seeing if the block
 	 * is already on the free list. But that's expensive, so we don't.
@@ -576,14 +686,87 @@ subpage_kfree(void *ptr)
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
-		remove_lists(pr, blktype);
+		remove_lists(pr);
 		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+		coremap_settag(KVADDR_TO_PADDR(prpage), NULL);
+		return prpage;
 	}
-	else {
+	return 0;
+}
+
+/*
+ * Put N blocks back on their pages with one acquisition of the lock.
+ * They must all be subpage blocks, already filled with 0xdeadbeef.
+ */
+static
+void
+subpage_putblocks(void **blocks, unsigned n)
+{
+	vaddr_t freepages[KM_MAGMAX];
+	unsigned i, nfreepages = 0;
+	struct pageref *pr;
+	vaddr_t prpage;
+
+	KASSERT(n <= KM_MAGMAX);
+
+	kmalloc_lock();
+	checksubpages();
+
+	for (i=0; i<n; i++) {
+		pr = subpage_findpage((vaddr_t)blocks[i]);
+		KASSERT(pr != NULL);
+		prpage = subpage_putblock(pr, blocks[i]);
+		if (prpage != 0) {
+			freepages[nfreepages++] = prpage;
+		}
+	}
+
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+/*
+ * Free a block straight back to its page, for when there are no
+ * magazines yet or its page predates the coremap. Returns -1 if it
+ * isn't a subpage block at all.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// page to free, if any
+
+	kmalloc_lock();
+
+	checksubpages();
+
+	pr = subpage_findpage((vaddr_t)ptr);
+	if (pr==NULL) {
+		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
+		return -1;
+	}
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef(ptr, sizes[PR_BLOCKTYPE(pr)]);
+
+	prpage = subpage_putblock(pr, ptr);
+
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	if (prpage != 0) {
+		/* Call free_kpages without kmalloc_spinlock. */
+		free_kpages(prpage);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
@@ -595,12 +778,217 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Per-CPU magazines.
+//
+// In front of the pages, each CPU keeps a small stack of free blocks
+// of each size, called a magazine. kmalloc and kfree use the current
+// CPU's magazine with interrupts off, and only go to the pages, under
+// the global spinlock, when it is empty or full: then a batch of
+// blocks is moved at once, half a magazine, so the next several calls
+// on that CPU need no lock again. Blocks in magazines look allocated
+// as far as the pages are concerned; they are filled with 0xdeadbeef
+// when freed, as before.
+//
+// kfree finds the block size through the coremap tag kmalloc puts on
+// each of its pages (coremap_settag), which points at the pageref.
+// Pages from before the coremap have no tag, and their blocks always
+// go back to the pages.
+//
+// Magazines are smaller for the larger blocks, to bound how much
+// memory they can hold back: at most 13k per CPU.
+//
+
+static const unsigned magsizes[NSIZES] = { 16, 16, 16, 8, 8, 4, 2, 2 };
+
+struct kmcache {
+	void *kc_rounds[KM_MAGMAX];	/* free blocks */
+	unsigned kc_nrounds;		/* how many there are */
+
+	/* statistics */
+	unsigned kc_hits;		/* kmallocs served from here */
+	unsigned kc_misses;		/* kmallocs that refilled it */
+	unsigned kc_frees;		/* kfrees put here */
+	unsigned kc_drains;		/* ...that emptied half of it first */
+};
+
+static struct kmcache kmcaches[MAXCPUS][NSIZES];
+
+/*
+ * kmalloc with the current CPU's magazine empty: get a batch of
+ * blocks from the pages, return one, and keep the rest.
+ */
+static
+void *
+kmcache_refill(unsigned blktype)
+{
+	void *blocks[KM_MAGMAX/2 + 1];
+	struct kmcache *kc;
+	unsigned got, i;
+	int spl;
+
+	got = subpage_getblocks(blktype, blocks, magsizes[blktype]/2 + 1);
+	if (got == 0) {
+		return NULL;
+	}
+
+	/* We may be on a different CPU now; use whichever we're on. */
+	spl = splhigh();
+	kc = &kmcaches[curcpu->c_number][blktype];
+	for (i=1; i<got && kc->kc_nrounds < magsizes[blktype]; i++) {
+		kc->kc_rounds[kc->kc_nrounds++] = blocks[i];
+	}
+	splx(spl);
+
+	if (i < got) {
+		/* It filled up behind our back. */
+		subpage_putblocks(&blocks[i], got - i);
+	}
+	return blocks[0];
+}
+
+static
+void *
+subpage_kmalloc(size_t sz)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	struct kmcache *kc;
+	void *retptr;
+	int spl;
+
+	blktype = blocktype(sz);
+
+	if (!CURCPU_EXISTS()) {
+		/* Too early in boot for magazines. */
+		if (subpage_getblocks(blktype, &retptr, 1) == 0) {
+			return NULL;
+		}
+		return retptr;
+	}
+
+	spl = splhigh();
+	kc = &kmcaches[curcpu->c_number][blktype];
+	if (kc->kc_nrounds > 0) {
+		retptr = kc->kc_rounds[--kc->kc_nrounds];
+		kc->kc_hits++;
+		splx(spl);
+		return retptr;
+	}
+	kc->kc_misses++;
+	splx(spl);
+
+	return kmcache_refill(blktype);
+}
+
+/*
+ * kfree of a block of size sizes[BLKTYPE]: keep it in the current
+ * CPU's magazine, first sending half the magazine back to the pages
+ * if it's full.
+ */
+static
+void
+kmcache_free(void *ptr, unsigned blktype)
+{
+	void *blocks[KM_MAGMAX/2];
+	struct kmcache *kc;
+	unsigned n;
+	int spl;
+
+	/* Check for proper positioning and alignment */
+	if (((vaddr_t)ptr % PAGE_SIZE) % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	spl = splhigh();
+	kc = &kmcaches[curcpu->c_number][blktype];
+	kc->kc_frees++;
+	if (kc->kc_nrounds < magsizes[blktype]) {
+		kc->kc_rounds[kc->kc_nrounds++] = ptr;
+		splx(spl);
+		return;
+	}
+
+	n = magsizes[blktype] / 2;
+	kc->kc_nrounds -= n;
+	memcpy(blocks, &kc->kc_rounds[kc->kc_nrounds], n * sizeof(void *));
+	kc->kc_rounds[kc->kc_nrounds++] = ptr;
+	kc->kc_drains++;
+	splx(spl);
+
+	subpage_putblocks(blocks, n);
+}
+
+/*
+ * Totals over all CPUs. The other CPUs' counts are read without
+ * stopping them, so may be slightly off.
+ */
+static
+void
+kmcache_printstats(void)
+{
+	struct kmcache *kc;
+	unsigned c, i, hits, misses, frees, drains, held;
+
+	kprintf("Magazines:   size     allocs   hit%%      frees  drains  held\n");
+	for (i=0; i<NSIZES; i++) {
+		hits = misses = frees = drains = held = 0;
+		for (c=0; c<MAXCPUS; c++) {
+			kc = &kmcaches[c][i];
+			hits += kc->kc_hits;
+			misses += kc->kc_misses;
+			frees += kc->kc_frees;
+			drains += kc->kc_drains;
+			held += kc->kc_nrounds;
+		}
+		kprintf("             %4lu %10u %5u%% %10u %7u %5u\n",
+			(unsigned long)sizes[i], hits + misses,
+			hits + misses == 0 ? 0 :
+			(unsigned)((unsigned long long)hits * 100 /
+				   (hits + misses)),
+			frees, drains, held);
+	}
+	kprintf("Subpage lock: %u acquisitions, %u contended\n",
+		kmalloc_nlocks, kmalloc_ncontended);
+}
+
+void
+kheap_printstats(void)
+{
+	struct pageref *pr;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kmalloc_spinlock);
+
+	kprintf("Subpage allocator status:\n");
+
+	for (pr = earlybase; pr != NULL; pr = pr->next_all) {
+		dumpsubpage(pr);
+	}
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		dumpsubpage(pr);
+	}
+	kmcache_printstats();
+
+	spinlock_release(&kmalloc_spinlock);
+
+	kmem_cache_printstats();
+}
+
 //
 ////////////////////////////////////////////////////////////
 
 void *
 kmalloc(size_t sz)
 {
+	void *ptr;
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -612,21 +1000,61 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 
+#if OPT_KMPROF
+		kmprof_alloc((void *)address, npages * PAGE_SIZE,
+			     __builtin_return_address(0));
+#endif
 		return (void *)address;
 	}
 
-	return subpage_kmalloc(sz);
+	ptr = subpage_kmalloc(sz);
+#if OPT_KMPROF
+	if (ptr != NULL) {
+		kmprof_alloc(ptr, sizes[blocktype(sz)],
+			     __builtin_return_address(0));
+	}
+#endif
+	return ptr;
 }
 
 void
 kfree(void *ptr)
 {
-	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
-	 */
+	struct pageref *pr;
+	void *tag;
+
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+
+#if OPT_KMPROF
+	kmprof_free(ptr);
+#endif
+
+	/*
+	 * The coremap tag of the block's page says what it is: a
+	 * subpage block, if it points at a pageref, which goes to a
+	 * magazine; or a big allocation, if it's NULL. Either way
+	 * there's nothing to search.
+	 */
+	if (coremap_gettag(KVADDR_TO_PADDR((vaddr_t)ptr & PAGE_FRAME), &tag)) {
+		pr = tag;
+		if (pr == NULL) {
+			KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+			free_kpages((vaddr_t)ptr);
+			return;
+		}
+		if (CURCPU_EXISTS()) {
+			kmcache_free(ptr, PR_BLOCKTYPE(pr));
+			return;
+		}
+	}
+
+	/*
+	 * Otherwise try subpage first; if that fails, assume it's a big
+	 * allocation.
+	 */
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
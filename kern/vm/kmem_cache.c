@@ -0,0 +1,342 @@
+/*
+ * Object caches.
+ *
+ * See kmem_cache.h for an overview.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+/* Empty slabs a cache keeps */
+#define KMEM_MAXEMPTY	1
+
+/* Fewest objects worth making a cache for */
+#define KMEM_MINPERSLAB	4
+
+/*
+ * A slab is one page: this header, then the objects. Each object is
+ * followed by a word linking it into its slab's free list when free,
+ * so the link doesn't disturb the object's constructed state.
+ *
+ * Each slab is on one of its cache's three lists. As with pagerefs in
+ * kmalloc, ks_pprev points at whatever points at this slab, so it can
+ * be moved between lists in constant time.
+ */
+struct kmem_slab {
+	struct kmem_slab *ks_next;
+	struct kmem_slab **ks_pprev;
+	struct kmem_cache *ks_cache;
+	void *ks_free;			/* first free object */
+	unsigned ks_nfree;
+};
+
+#define KMEM_SLABHDR	ROUNDUP(sizeof(struct kmem_slab), 8)
+#define KMEM_SLABOBJ(slab, i, kc) \
+	((void *)((vaddr_t)(slab) + KMEM_SLABHDR + (i) * (kc)->kc_bufsize))
+#define KMEM_LINK(kc, obj) \
+	(*(void **)((vaddr_t)(obj) + (kc)->kc_bufsize - sizeof(void *)))
+
+/* All caches that have been used, for kmem_cache_printstats. */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+//
+// Slabs
+
+static
+void
+kmem_slab_insert(struct kmem_slab **head, struct kmem_slab *slab)
+{
+	slab->ks_next = *head;
+	slab->ks_pprev = head;
+	if (slab->ks_next != NULL) {
+		slab->ks_next->ks_pprev = &slab->ks_next;
+	}
+	*head = slab;
+}
+
+static
+void
+kmem_slab_remove(struct kmem_slab *slab)
+{
+	KASSERT(*slab->ks_pprev == slab);
+	*slab->ks_pprev = slab->ks_next;
+	if (slab->ks_next != NULL) {
+		slab->ks_next->ks_pprev = slab->ks_pprev;
+	}
+	slab->ks_next = NULL;
+	slab->ks_pprev = NULL;
+}
+
+/*
+ * Work out the layout of KC's slabs. Called on first use.
+ */
+static
+void
+kmem_cache_setup(struct kmem_cache *kc)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	kc->kc_bufsize = ROUNDUP(ROUNDUP(kc->kc_objsize, sizeof(void *))
+				 + sizeof(void *), 8);
+	kc->kc_perslab = (PAGE_SIZE - KMEM_SLABHDR) / kc->kc_bufsize;
+	if (kc->kc_perslab < KMEM_MINPERSLAB) {
+		panic("kmem_cache %s: objects of %lu bytes are too big\n",
+		      kc->kc_name, (unsigned long)kc->kc_objsize);
+	}
+}
+
+/*
+ * Run the destructor on the first N objects of SLAB, and give back
+ * its page.
+ */
+static
+void
+kmem_slab_destroy(struct kmem_cache *kc, struct kmem_slab *slab, unsigned n)
+{
+	unsigned i;
+
+	if (kc->kc_dtor != NULL) {
+		for (i=0; i<n; i++) {
+			kc->kc_dtor(KMEM_SLABOBJ(slab, i, kc));
+		}
+	}
+	free_kpages((vaddr_t)slab);
+}
+
+/*
+ * Make a new slab of constructed objects, all free. Called without
+ * the cache's lock, as both alloc_kpages and the constructor may
+ * sleep.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *slab;
+	void *obj;
+	unsigned i;
+	int result;
+
+	slab = (struct kmem_slab *)alloc_kpages(1);
+	if (slab == NULL) {
+		return NULL;
+	}
+	slab->ks_next = NULL;
+	slab->ks_pprev = NULL;
+	slab->ks_cache = kc;
+	slab->ks_free = NULL;
+	slab->ks_nfree = 0;
+
+	/* Build the free list backwards, so it starts at the bottom. */
+	for (i=0; i<kc->kc_perslab; i++) {
+		obj = KMEM_SLABOBJ(slab, i, kc);
+		if (kc->kc_ctor != NULL) {
+			result = kc->kc_ctor(obj);
+			if (result) {
+				kmem_slab_destroy(kc, slab, i);
+				return NULL;
+			}
+		}
+	}
+	for (i=kc->kc_perslab; i-- > 0; ) {
+		obj = KMEM_SLABOBJ(slab, i, kc);
+		KMEM_LINK(kc, obj) = slab->ks_free;
+		slab->ks_free = obj;
+		slab->ks_nfree++;
+	}
+	return slab;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_objsize = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	kc->kc_bufsize = 0;
+	kc->kc_perslab = 0;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_full = NULL;
+	kc->kc_empty = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_nallocs = 0;
+	kc->kc_nfrees = 0;
+	kc->kc_ngrows = 0;
+	kc->kc_nshrinks = 0;
+	kc->kc_next = NULL;
+	kc->kc_listed = false;
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_slab *slab;
+
+	KASSERT(kc->kc_partial == NULL);
+	KASSERT(kc->kc_full == NULL);
+
+	while (kc->kc_empty != NULL) {
+		slab = kc->kc_empty;
+		kmem_slab_remove(slab);
+		kmem_slab_destroy(kc, slab, kc->kc_perslab);
+	}
+
+	if (kc->kc_listed) {
+		spinlock_acquire(&kmem_caches_lock);
+		for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+			KASSERT(*kcp != NULL);
+		}
+		*kcp = kc->kc_next;
+		spinlock_release(&kmem_caches_lock);
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *slab;
+	void *obj;
+	bool wasempty, newcache = false;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_perslab == 0) {
+		kmem_cache_setup(kc);
+		newcache = !kc->kc_listed;
+		kc->kc_listed = true;
+	}
+
+	if (kc->kc_partial == NULL && kc->kc_empty == NULL) {
+		spinlock_release(&kc->kc_lock);
+		slab = kmem_slab_create(kc);
+		if (slab == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kmem_slab_insert(&kc->kc_empty, slab);
+		kc->kc_nempty++;
+		kc->kc_nslabs++;
+		kc->kc_ngrows++;
+	}
+
+	/* Fill partly used slabs first, so empty ones can be let go. */
+	slab = kc->kc_partial != NULL ? kc->kc_partial : kc->kc_empty;
+	wasempty = slab->ks_nfree == kc->kc_perslab;
+	KASSERT(slab->ks_nfree > 0);
+
+	obj = slab->ks_free;
+	slab->ks_free = KMEM_LINK(kc, obj);
+	slab->ks_nfree--;
+	kc->kc_nallocs++;
+
+	if (wasempty || slab->ks_nfree == 0) {
+		kmem_slab_remove(slab);
+		kmem_slab_insert(slab->ks_nfree == 0 ?
+				 &kc->kc_full : &kc->kc_partial, slab);
+	}
+	if (wasempty) {
+		kc->kc_nempty--;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (newcache) {
+		spinlock_acquire(&kmem_caches_lock);
+		kc->kc_next = kmem_caches;
+		kmem_caches = kc;
+		spinlock_release(&kmem_caches_lock);
+	}
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *slab;
+	bool wasfull;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	slab = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	if (slab->ks_cache != kc ||
+	    ((vaddr_t)obj - (vaddr_t)KMEM_SLABOBJ(slab, 0, kc))
+	    % kc->kc_bufsize != 0) {
+		panic("kmem_cache_free: %p is not from cache %s\n",
+		      obj, kc->kc_name);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+
+	KASSERT(slab->ks_nfree < kc->kc_perslab);
+	wasfull = slab->ks_nfree == 0;
+	KMEM_LINK(kc, obj) = slab->ks_free;
+	slab->ks_free = obj;
+	slab->ks_nfree++;
+	kc->kc_nfrees++;
+
+	if (slab->ks_nfree == kc->kc_perslab) {
+		kmem_slab_remove(slab);
+		if (kc->kc_nempty >= KMEM_MAXEMPTY) {
+			/* Enough empty ones already; let it go. */
+			kc->kc_nslabs--;
+			kc->kc_nshrinks++;
+			spinlock_release(&kc->kc_lock);
+			kmem_slab_destroy(kc, slab, kc->kc_perslab);
+			return;
+		}
+		kmem_slab_insert(&kc->kc_empty, slab);
+		kc->kc_nempty++;
+	}
+	else if (wasfull) {
+		kmem_slab_remove(slab);
+		kmem_slab_insert(&kc->kc_partial, slab);
+	}
+
+	spinlock_release(&kc->kc_lock);
+}
+
+/*
+ * The caches' counts are read without their locks, so may be
+ * slightly off.
+ */
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kprintf("Object caches: name           size  slabs  inuse"
+		"     allocs   grows shrinks\n");
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		kprintf("               %-14s %4lu %6u %6u %10u %7u %7u\n",
+			kc->kc_name, (unsigned long)kc->kc_objsize,
+			kc->kc_nslabs, kc->kc_nallocs - kc->kc_nfrees,
+			kc->kc_nallocs, kc->kc_ngrows, kc->kc_nshrinks);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
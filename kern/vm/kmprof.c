@@ -0,0 +1,347 @@
+/*
+ * kmalloc profiling by call site.
+ *
+ * See kmprof.h for an overview.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <kmprof.h>
+
+/* Most sites, and most live blocks, we keep track of; powers of 2 */
+#define KMPROF_NSITES	512
+#define KMPROF_NBLOCKS	8192
+
+/* Most live blocks before the table is considered full */
+#define KMPROF_MAXBLOCKS	(KMPROF_NBLOCKS / 4 * 3)
+
+/* Sites shown in each list */
+#define KMPROF_SHOW	16
+
+struct kmprof_site {
+	const void *ks_caller;		/* NULL if the slot is empty */
+	size_t ks_size;			/* block size */
+	unsigned ks_allocs;
+	unsigned ks_frees;
+	unsigned ks_recent;		/* allocs since kmprof_epoch */
+};
+
+struct kmprof_block {
+	vaddr_t kb_addr;		/* 0 if the slot is empty */
+	unsigned kb_site;		/* index into kmprof_sites */
+};
+
+/*
+ * Both tables are open addressing with linear probing. Sites are
+ * never removed. Blocks are removed by moving later entries of the
+ * same probe run back into the hole, so there are no tombstones.
+ *
+ * kmprof_lock protects all of it. It's a spinlock, as kmalloc can be
+ * called with other spinlocks held.
+ */
+static struct kmprof_site kmprof_sites[KMPROF_NSITES];
+static struct kmprof_block kmprof_blocks[KMPROF_NBLOCKS];
+static unsigned kmprof_nsites;
+static unsigned kmprof_nblocks;
+static unsigned kmprof_untracked;	/* allocs we couldn't record */
+static struct spinlock kmprof_lock = SPINLOCK_INITIALIZER;
+
+/* Start of the current rate interval */
+static time_t kmprof_epochsecs;
+static uint32_t kmprof_epochnsecs;
+
+////////////////////////////////////////////////////////////
+//
+// Tables
+
+static
+unsigned
+kmprof_sitehash(const void *caller, size_t size)
+{
+	return (((vaddr_t)caller >> 2) * 2654435761U ^ size)
+		% KMPROF_NSITES;
+}
+
+static
+unsigned
+kmprof_blockhash(vaddr_t addr)
+{
+	/* Blocks are at least 16 bytes apart. */
+	return ((addr >> 4) * 2654435761U) % KMPROF_NBLOCKS;
+}
+
+/*
+ * Find the site for CALLER and SIZE, making it if need be. Returns
+ * -1 if the table is full.
+ */
+static
+int
+kmprof_getsite(const void *caller, size_t size)
+{
+	struct kmprof_site *ks;
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&kmprof_lock));
+
+	i = kmprof_sitehash(caller, size);
+	for (n=0; n<KMPROF_NSITES; n++) {
+		ks = &kmprof_sites[i];
+		if (ks->ks_caller == caller && ks->ks_size == size) {
+			return i;
+		}
+		if (ks->ks_caller == NULL) {
+			if (kmprof_nsites >= KMPROF_NSITES - 1) {
+				/* keep one empty slot so lookups end */
+				return -1;
+			}
+			ks->ks_caller = caller;
+			ks->ks_size = size;
+			kmprof_nsites++;
+			return i;
+		}
+		i = (i + 1) % KMPROF_NSITES;
+	}
+	return -1;
+}
+
+/*
+ * Find the slot of the live block at ADDR, or -1 if it wasn't
+ * recorded.
+ */
+static
+int
+kmprof_findblock(vaddr_t addr)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&kmprof_lock));
+
+	for (i = kmprof_blockhash(addr);
+	     kmprof_blocks[i].kb_addr != 0;
+	     i = (i + 1) % KMPROF_NBLOCKS) {
+		if (kmprof_blocks[i].kb_addr == addr) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Empty slot I of the block table, moving later entries back into it
+ * as needed so every entry can still be reached from its hash slot.
+ */
+static
+void
+kmprof_removeblock(unsigned i)
+{
+	unsigned j, h;
+
+	KASSERT(spinlock_do_i_hold(&kmprof_lock));
+
+	j = i;
+	while (1) {
+		j = (j + 1) % KMPROF_NBLOCKS;
+		if (kmprof_blocks[j].kb_addr == 0) {
+			break;
+		}
+		h = kmprof_blockhash(kmprof_blocks[j].kb_addr);
+		/* Move it back unless its hash slot is in (i, j]. */
+		if (i <= j ? (h <= i || h > j) : (h <= i && h > j)) {
+			kmprof_blocks[i] = kmprof_blocks[j];
+			i = j;
+		}
+	}
+	kmprof_blocks[i].kb_addr = 0;
+	kmprof_nblocks--;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+void
+kmprof_bootstrap(void)
+{
+	gettime(&kmprof_epochsecs, &kmprof_epochnsecs);
+}
+
+void
+kmprof_alloc(void *ptr, size_t bytes, const void *caller)
+{
+	vaddr_t addr = (vaddr_t)ptr;
+	int site;
+	unsigned i;
+
+	spinlock_acquire(&kmprof_lock);
+
+	site = kmprof_getsite(caller, bytes);
+	if (site < 0 || kmprof_nblocks >= KMPROF_MAXBLOCKS) {
+		kmprof_untracked++;
+		spinlock_release(&kmprof_lock);
+		return;
+	}
+	kmprof_sites[site].ks_allocs++;
+	kmprof_sites[site].ks_recent++;
+
+	KASSERT(kmprof_findblock(addr) < 0);
+	for (i = kmprof_blockhash(addr);
+	     kmprof_blocks[i].kb_addr != 0;
+	     i = (i + 1) % KMPROF_NBLOCKS) {
+		/* nothing */
+	}
+	kmprof_blocks[i].kb_addr = addr;
+	kmprof_blocks[i].kb_site = site;
+	kmprof_nblocks++;
+
+	spinlock_release(&kmprof_lock);
+}
+
+void
+kmprof_free(void *ptr)
+{
+	int i;
+
+	spinlock_acquire(&kmprof_lock);
+	i = kmprof_findblock((vaddr_t)ptr);
+	if (i >= 0) {
+		kmprof_sites[kmprof_blocks[i].kb_site].ks_frees++;
+		kmprof_removeblock(i);
+	}
+	spinlock_release(&kmprof_lock);
+}
+
+void
+kmprof_recaller(void *ptr, const void *caller)
+{
+	struct kmprof_site *old;
+	int i, site;
+
+	spinlock_acquire(&kmprof_lock);
+	i = kmprof_findblock((vaddr_t)ptr);
+	if (i >= 0) {
+		old = &kmprof_sites[kmprof_blocks[i].kb_site];
+		site = kmprof_getsite(caller, old->ks_size);
+		if (site >= 0) {
+			/* Take back the alloc from the old site. */
+			old->ks_allocs--;
+			if (old->ks_recent > 0) {
+				old->ks_recent--;
+			}
+			kmprof_sites[site].ks_allocs++;
+			kmprof_sites[site].ks_recent++;
+			kmprof_blocks[i].kb_site = site;
+		}
+	}
+	spinlock_release(&kmprof_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reporting
+
+static
+unsigned
+kmprof_livebytes(const struct kmprof_site *ks)
+{
+	return (ks->ks_allocs - ks->ks_frees) * ks->ks_size;
+}
+
+/*
+ * Sort the N sites in SITES, highest first, by live bytes if BYLIVE,
+ * else by recent allocations. There aren't many; insertion sort.
+ */
+static
+void
+kmprof_sort(struct kmprof_site *sites, unsigned n, bool bylive)
+{
+	struct kmprof_site tmp;
+	unsigned i, j;
+
+	for (i=1; i<n; i++) {
+		tmp = sites[i];
+		for (j=i; j>0; j--) {
+			if (bylive ?
+			    kmprof_livebytes(&sites[j-1]) >=
+			    kmprof_livebytes(&tmp) :
+			    sites[j-1].ks_recent >= tmp.ks_recent) {
+				break;
+			}
+			sites[j] = sites[j-1];
+		}
+		sites[j] = tmp;
+	}
+}
+
+static
+void
+kmprof_printsite(const struct kmprof_site *ks, unsigned ms)
+{
+	kprintf("    0x%08lx %5lu %7u %9u %9u %9u %8u\n",
+		(unsigned long)ks->ks_caller, (unsigned long)ks->ks_size,
+		ks->ks_allocs - ks->ks_frees, kmprof_livebytes(ks),
+		ks->ks_allocs, ks->ks_frees,
+		(unsigned)((uint64_t)ks->ks_recent * 1000 / ms));
+}
+
+void
+kmprof_printstats(void)
+{
+	struct kmprof_site *sites;
+	unsigned i, n, nblocks, untracked, ms;
+	time_t nowsecs, secs;
+	uint32_t nownsecs, nsecs;
+
+	/* Don't call kmalloc with the lock; it would need it too. */
+	sites = kmalloc(KMPROF_NSITES * sizeof(*sites));
+	if (sites == NULL) {
+		kprintf("kmprof: out of memory\n");
+		return;
+	}
+
+	gettime(&nowsecs, &nownsecs);
+
+	spinlock_acquire(&kmprof_lock);
+	n = 0;
+	for (i=0; i<KMPROF_NSITES; i++) {
+		if (kmprof_sites[i].ks_caller != NULL) {
+			sites[n++] = kmprof_sites[i];
+			kmprof_sites[i].ks_recent = 0;
+		}
+	}
+	nblocks = kmprof_nblocks;
+	untracked = kmprof_untracked;
+	getinterval(kmprof_epochsecs, kmprof_epochnsecs, nowsecs, nownsecs,
+		    &secs, &nsecs);
+	kmprof_epochsecs = nowsecs;
+	kmprof_epochnsecs = nownsecs;
+	spinlock_release(&kmprof_lock);
+
+	ms = secs * 1000 + nsecs / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+
+	kprintf("kmalloc profile: %u sites, %u live blocks, "
+		"%u allocations untracked\n", n, nblocks, untracked);
+
+	kprintf("By live bytes:\n");
+	kprintf("    caller      size    live     bytes    allocs"
+		"     frees  allocs/s\n");
+	kmprof_sort(sites, n, true);
+	for (i=0; i<n && i<KMPROF_SHOW; i++) {
+		kmprof_printsite(&sites[i], ms);
+	}
+
+	kprintf("By allocation rate over the last %u.%03u seconds:\n",
+		ms / 1000, ms % 1000);
+	kprintf("    caller      size    live     bytes    allocs"
+		"     frees  allocs/s\n");
+	kmprof_sort(sites, n, false);
+	for (i=0; i<n && i<KMPROF_SHOW && sites[i].ks_recent > 0; i++) {
+		kmprof_printsite(&sites[i], ms);
+	}
+
+	kfree(sites);
+}
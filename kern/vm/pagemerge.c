@@ -0,0 +1,370 @@
+/*
+ * Same-page merging.
+ *
+ * See pagemerge.h for an overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <array.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <vpage.h>
+#include <pagemerge.h>
+
+/* Seconds between scans */
+#define PAGEMERGE_INTERVAL	5
+
+/*
+ * Pages seen so far in a scan, by hash: open addressing, linear
+ * probing. Pages are named by where they're mapped rather than by
+ * their struct vpage, as the owner may replace or free the page
+ * while we're looking at other address spaces; holding a reference
+ * instead would make every candidate look shared and get copied on
+ * its next write. Once it's full, later pages are only merged with
+ * those already in it.
+ */
+#define PAGEMERGE_TABLESIZE	512
+
+struct mergeent {
+	uint32_t me_hash;
+	struct addrspace *me_as;	/* NULL if the slot is empty */
+	vaddr_t me_vaddr;
+};
+
+static struct mergeent *pm_table;
+
+/*
+ * Address spaces to scan. pm_lock protects this and pm_enabled, and
+ * is held for all of a scan; it comes before any address space's
+ * as_lock.
+ */
+static struct array *pm_spaces;
+static struct lock *pm_lock;
+static struct cv *pm_cv;		/* for turning it on */
+static bool pm_enabled;
+
+/* Statistics; only changed by the thread */
+static unsigned pm_passes;	/* scans done */
+static unsigned pm_scanned;	/* pages hashed */
+static unsigned pm_merged;	/* pages replaced by a duplicate */
+static unsigned pm_freed;	/* of those, how many freed a frame */
+
+////////////////////////////////////////////////////////////
+//
+// Comparing pages
+
+static
+uint32_t
+pagemerge_hash(paddr_t pa)
+{
+	const uint32_t *p = (const uint32_t *)PADDR_TO_KVADDR(pa);
+	uint32_t hash;
+	unsigned i;
+
+	/* FNV-1a, a word at a time */
+	hash = 2166136261U;
+	for (i=0; i<PAGE_SIZE / sizeof(uint32_t); i++) {
+		hash = (hash ^ p[i]) * 16777619U;
+	}
+	return hash;
+}
+
+static
+bool
+pagemerge_same(paddr_t pa1, paddr_t pa2)
+{
+	const uint32_t *p1 = (const uint32_t *)PADDR_TO_KVADDR(pa1);
+	const uint32_t *p2 = (const uint32_t *)PADDR_TO_KVADDR(pa2);
+	unsigned i;
+
+	for (i=0; i<PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (p1[i] != p2[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Decide whether the page VP mapped at VADDR in AS could be merged,
+ * and if so hash it.
+ */
+static
+bool
+pagemerge_candidate(struct addrspace *as, vaddr_t vaddr, struct vpage *vp,
+		    uint32_t *hash)
+{
+	bool canread, canwrite, shared, ok;
+
+	as_pageaccess(as, vaddr, &canread, &canwrite, &shared);
+	if (shared) {
+		return false;
+	}
+
+	/* Don't wait for it; it can be done next time. */
+	if (!vpage_trylock(vp)) {
+		return false;
+	}
+	ok = vp->vp_paddr != 0 && vp->vp_text == NULL;
+	if (ok) {
+		*hash = pagemerge_hash(vp->vp_paddr);
+	}
+	vpage_unlock(vp);
+	return ok;
+}
+
+/*
+ * Look for an earlier page with hash HASH. If there isn't one, note
+ * that AS has one at VADDR, and return NULL.
+ */
+static
+struct mergeent *
+pagemerge_lookup(uint32_t hash, struct addrspace *as, vaddr_t vaddr)
+{
+	struct mergeent *me;
+	unsigned i, n;
+
+	i = hash % PAGEMERGE_TABLESIZE;
+	for (n=0; n<PAGEMERGE_TABLESIZE; n++) {
+		me = &pm_table[i];
+		if (me->me_as == NULL) {
+			me->me_hash = hash;
+			me->me_as = as;
+			me->me_vaddr = vaddr;
+			return NULL;
+		}
+		if (me->me_hash == hash) {
+			return me;
+		}
+		i = (i + 1) % PAGEMERGE_TABLESIZE;
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Merging
+
+/*
+ * If the page in *SLOT has the same contents as KEEP, map KEEP there
+ * instead.
+ */
+static
+void
+pagemerge_merge(struct vpage **slot, struct vpage *keep)
+{
+	struct vpage *vp = *slot;
+	bool same;
+
+	if (!vpage_trylock(vp)) {
+		return;
+	}
+	if (!vpage_trylock(keep)) {
+		vpage_unlock(vp);
+		return;
+	}
+
+	same = false;
+	if (vp->vp_paddr != 0 && keep->vp_paddr != 0 &&
+	    vp->vp_text == NULL && keep->vp_text == NULL) {
+		/*
+		 * Make sure nothing can write either page while we
+		 * compare them, or afterwards while KEEP is still
+		 * mapped writable anywhere. Reloading a mapping needs
+		 * the busy lock, which we have.
+		 */
+		tlb_shootdown_paddr(vp->vp_paddr);
+		tlb_shootdown_paddr(keep->vp_paddr);
+		same = pagemerge_same(vp->vp_paddr, keep->vp_paddr);
+	}
+	if (same) {
+		/*
+		 * From now on KEEP is shared, and so copy-on-write.
+		 * Whatever it was read from may not be where VP came
+		 * from, so it can't be dropped and read again.
+		 */
+		vpage_incref(keep);
+		keep->vp_modified = true;
+		*slot = keep;
+	}
+
+	vpage_unlock(keep);
+	vpage_unlock(vp);
+	if (!same) {
+		return;
+	}
+
+	pm_merged++;
+	if (!vpage_isshared(vp)) {
+		pm_freed++;
+	}
+	vpage_decref(vp);
+}
+
+/*
+ * pt_foreach callback for a scan: look for an earlier page the same
+ * as this one, and merge it if so. DATA is the address space, whose
+ * lock we hold.
+ */
+static
+int
+pagemerge_scanpage(vaddr_t vaddr, struct vpage **slot, void *data)
+{
+	struct addrspace *as = data;
+	struct addrspace *other;
+	struct mergeent *me;
+	struct vpage *keep;
+	bool canread, canwrite, shared;
+	uint32_t hash;
+
+	if (!pagemerge_candidate(as, vaddr, *slot, &hash)) {
+		return 0;
+	}
+	pm_scanned++;
+
+	me = pagemerge_lookup(hash, as, vaddr);
+	if (me == NULL) {
+		return 0;
+	}
+
+	/* The earlier page's owner may have changed it since. */
+	other = me->me_as;
+	if (other != as) {
+		as_scanbegin(other);
+	}
+	keep = pt_lookup(other->as_pt, me->me_vaddr);
+	as_pageaccess(other, me->me_vaddr, &canread, &canwrite, &shared);
+	if (keep != NULL && keep != *slot && !shared) {
+		pagemerge_merge(slot, keep);
+	}
+	if (other != as) {
+		as_scanend(other);
+	}
+	return 0;
+}
+
+/*
+ * Scan every address space once. Called with pm_lock held.
+ */
+static
+void
+pagemerge_pass(void)
+{
+	struct addrspace *as;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(pm_lock));
+
+	for (i=0; i<PAGEMERGE_TABLESIZE; i++) {
+		pm_table[i].me_as = NULL;
+	}
+
+	for (i=0; i<array_num(pm_spaces); i++) {
+		as = array_get(pm_spaces, i);
+		as_scanbegin(as);
+		pt_foreach(as->as_pt, 0, USERSPACETOP, pagemerge_scanpage, as);
+		as_scanend(as);
+	}
+	pm_passes++;
+}
+
+static
+void
+pagemerge_thread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		lock_acquire(pm_lock);
+		while (!pm_enabled) {
+			cv_wait(pm_cv, pm_lock);
+		}
+		pagemerge_pass();
+		lock_release(pm_lock);
+
+		clocksleep(PAGEMERGE_INTERVAL);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+void
+pagemerge_bootstrap(void)
+{
+	int result;
+
+	pm_table = kmalloc(PAGEMERGE_TABLESIZE * sizeof(struct mergeent));
+	pm_spaces = array_create();
+	pm_lock = lock_create("pagemerge");
+	pm_cv = cv_create("pagemerge");
+	if (pm_table == NULL || pm_spaces == NULL || pm_lock == NULL ||
+	    pm_cv == NULL) {
+		panic("pagemerge_bootstrap: out of memory\n");
+	}
+	pm_enabled = false;
+
+	result = thread_fork("pagemerge", NULL, pagemerge_thread, NULL, 0);
+	if (result) {
+		panic("pagemerge_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+void
+pagemerge_register(struct addrspace *as)
+{
+	KASSERT(!as->as_merging);
+
+	lock_acquire(pm_lock);
+	if (array_add(pm_spaces, as, NULL) == 0) {
+		as->as_merging = true;
+	}
+	lock_release(pm_lock);
+}
+
+void
+pagemerge_unregister(struct addrspace *as)
+{
+	unsigned i;
+
+	KASSERT(as->as_merging);
+
+	lock_acquire(pm_lock);
+	for (i=0; i<array_num(pm_spaces); i++) {
+		if (array_get(pm_spaces, i) == as) {
+			array_remove(pm_spaces, i);
+			break;
+		}
+	}
+	as->as_merging = false;
+	lock_release(pm_lock);
+}
+
+void
+pagemerge_enable(bool on)
+{
+	lock_acquire(pm_lock);
+	pm_enabled = on;
+	if (on) {
+		cv_signal(pm_cv, pm_lock);
+	}
+	lock_release(pm_lock);
+}
+
+void
+pagemerge_printstats(void)
+{
+	kprintf("Page merging: %s, every %d seconds\n",
+		pm_enabled ? "on" : "off", PAGEMERGE_INTERVAL);
+	kprintf("    %u scans, %u pages hashed, %u merged, %u frames freed\n",
+		pm_passes, pm_scanned, pm_merged, pm_freed);
+}
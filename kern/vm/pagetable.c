@@ -0,0 +1,142 @@
+/*
+ * Two-level page table.
+ *
+ * See pagetable.h for an overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+#define PT_L2SIZE	(PAGE_SIZE / sizeof(struct vpage *))
+#define PT_L2SPAN	(PT_L2SIZE * PAGE_SIZE)	/* bytes covered by a L2 */
+#define PT_L1SIZE	(USERSPACETOP / PT_L2SPAN)
+
+#define PT_L1INDEX(va)	((va) / PT_L2SPAN)
+#define PT_L2INDEX(va)	(((va) / PAGE_SIZE) % PT_L2SIZE)
+
+struct pagetable {
+	struct vpage **pt_l1[PT_L1SIZE];
+};
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_L1SIZE; i++) {
+		pt->pt_l1[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+
+	for (i=0; i<PT_L1SIZE; i++) {
+		if (pt->pt_l1[i] == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2SIZE; j++) {
+			KASSERT(pt->pt_l1[i][j] == NULL);
+		}
+		kfree(pt->pt_l1[i]);
+	}
+	kfree(pt);
+}
+
+struct vpage *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr)
+{
+	struct vpage **l2;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	l2 = pt->pt_l1[PT_L1INDEX(vaddr)];
+	if (l2 == NULL) {
+		return NULL;
+	}
+	return l2[PT_L2INDEX(vaddr)];
+}
+
+int
+pt_insert(struct pagetable *pt, vaddr_t vaddr, struct vpage *vp)
+{
+	struct vpage **l2;
+	unsigned j;
+
+	KASSERT(vaddr < USERSPACETOP);
+	KASSERT(vp != NULL);
+
+	l2 = pt->pt_l1[PT_L1INDEX(vaddr)];
+	if (l2 == NULL) {
+		l2 = kmalloc(PT_L2SIZE * sizeof(struct vpage *));
+		if (l2 == NULL) {
+			return ENOMEM;
+		}
+		for (j=0; j<PT_L2SIZE; j++) {
+			l2[j] = NULL;
+		}
+		pt->pt_l1[PT_L1INDEX(vaddr)] = l2;
+	}
+
+	KASSERT(l2[PT_L2INDEX(vaddr)] == NULL);
+	l2[PT_L2INDEX(vaddr)] = vp;
+	return 0;
+}
+
+struct vpage *
+pt_remove(struct pagetable *pt, vaddr_t vaddr)
+{
+	struct vpage **l2;
+	struct vpage *vp;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	l2 = pt->pt_l1[PT_L1INDEX(vaddr)];
+	if (l2 == NULL) {
+		return NULL;
+	}
+	vp = l2[PT_L2INDEX(vaddr)];
+	l2[PT_L2INDEX(vaddr)] = NULL;
+	return vp;
+}
+
+int
+pt_foreach(struct pagetable *pt, vaddr_t start, vaddr_t end,
+	   pt_foreach_func func, void *data)
+{
+	struct vpage **l2;
+	vaddr_t va;
+	int result;
+
+	KASSERT((start & PAGE_FRAME) == start);
+	KASSERT(end <= USERSPACETOP);
+
+	va = start;
+	while (va < end) {
+		l2 = pt->pt_l1[PT_L1INDEX(va)];
+		if (l2 == NULL) {
+			/* skip to the start of the next second-level table */
+			va = (PT_L1INDEX(va) + 1) * PT_L2SPAN;
+			continue;
+		}
+		if (l2[PT_L2INDEX(va)] != NULL) {
+			result = func(va, &l2[PT_L2INDEX(va)], data);
+			if (result) {
+				return result;
+			}
+		}
+		va += PAGE_SIZE;
+	}
+	return 0;
+}
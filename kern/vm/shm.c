@@ -0,0 +1,272 @@
+/*
+ * Shared memory segments.
+ *
+ * See shm.h for an overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/shm.h>
+#include <lib.h>
+#include <array.h>
+#include <synch.h>
+#include <vm.h>
+#include <vpage.h>
+#include <shm.h>
+
+/* Largest segment, in pages (1M) */
+#define SHM_MAXPAGES	256
+
+/* Most segments at once */
+#define SHM_MAXSEGS	64
+
+struct shmseg {
+	key_t sh_key;			/* IPC_PRIVATE if none or removed */
+	int sh_id;
+	size_t sh_npages;
+	struct vpage **sh_pages;
+	unsigned sh_nattach;		/* number of mappings */
+};
+
+/* All segments. shm_lock protects this and everything in them. */
+static struct array *shm_segs;
+static struct lock *shm_lock;
+static int shm_nextid;
+
+void
+shm_bootstrap(void)
+{
+	shm_segs = array_create();
+	shm_lock = lock_create("shm");
+	if (shm_segs == NULL || shm_lock == NULL) {
+		panic("shm_bootstrap: out of memory\n");
+	}
+	shm_nextid = 1;
+}
+
+/*
+ * Find the segment with id ID, or if ID is 0 the one with key KEY,
+ * and its position in shm_segs. Returns NULL if there isn't one.
+ */
+static
+struct shmseg *
+shm_find(int id, key_t key, unsigned *index)
+{
+	struct shmseg *seg;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(shm_lock));
+
+	for (i=0; i<array_num(shm_segs); i++) {
+		seg = array_get(shm_segs, i);
+		if (id != 0 ? seg->sh_id == id : seg->sh_key == key) {
+			if (index != NULL) {
+				*index = i;
+			}
+			return seg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Drop the segment's references to its pages, and free it.
+ */
+static
+void
+shm_free(struct shmseg *seg)
+{
+	unsigned i;
+
+	for (i=0; i<seg->sh_npages; i++) {
+		if (seg->sh_pages[i] != NULL) {
+			vpage_decref(seg->sh_pages[i]);
+		}
+	}
+	kfree(seg->sh_pages);
+	kfree(seg);
+}
+
+/*
+ * Make a segment of NPAGES zero-filled pages.
+ */
+static
+struct shmseg *
+shm_create(key_t key, size_t npages)
+{
+	struct shmseg *seg;
+	unsigned i;
+
+	seg = kmalloc(sizeof(*seg));
+	if (seg == NULL) {
+		return NULL;
+	}
+	seg->sh_pages = kmalloc(npages * sizeof(struct vpage *));
+	if (seg->sh_pages == NULL) {
+		kfree(seg);
+		return NULL;
+	}
+	seg->sh_key = key;
+	seg->sh_id = 0;
+	seg->sh_npages = npages;
+	seg->sh_nattach = 0;
+	for (i=0; i<npages; i++) {
+		seg->sh_pages[i] = NULL;
+	}
+
+	for (i=0; i<npages; i++) {
+		seg->sh_pages[i] = vpage_create();
+		if (seg->sh_pages[i] == NULL) {
+			shm_free(seg);
+			return NULL;
+		}
+		vpage_unlock(seg->sh_pages[i]);
+	}
+	return seg;
+}
+
+int
+shm_get(key_t key, size_t size, int flags, int *id)
+{
+	struct shmseg *seg;
+	int result;
+
+	if (size > SHM_MAXPAGES * PAGE_SIZE) {
+		return EINVAL;
+	}
+
+	lock_acquire(shm_lock);
+
+	if (key != IPC_PRIVATE) {
+		seg = shm_find(0, key, NULL);
+		if (seg != NULL) {
+			if ((flags & IPC_CREAT) && (flags & IPC_EXCL)) {
+				lock_release(shm_lock);
+				return EEXIST;
+			}
+			if (size > seg->sh_npages * PAGE_SIZE) {
+				lock_release(shm_lock);
+				return EINVAL;
+			}
+			*id = seg->sh_id;
+			lock_release(shm_lock);
+			return 0;
+		}
+		if ((flags & IPC_CREAT) == 0) {
+			lock_release(shm_lock);
+			return ENOENT;
+		}
+	}
+
+	if (size == 0) {
+		lock_release(shm_lock);
+		return EINVAL;
+	}
+	if (array_num(shm_segs) >= SHM_MAXSEGS) {
+		lock_release(shm_lock);
+		return ENOSPC;
+	}
+
+	seg = shm_create(key, DIVROUNDUP(size, PAGE_SIZE));
+	if (seg == NULL) {
+		lock_release(shm_lock);
+		return ENOMEM;
+	}
+	result = array_add(shm_segs, seg, NULL);
+	if (result) {
+		lock_release(shm_lock);
+		shm_free(seg);
+		return result;
+	}
+	seg->sh_id = shm_nextid++;
+
+	*id = seg->sh_id;
+	lock_release(shm_lock);
+	return 0;
+}
+
+int
+shm_remove(int id)
+{
+	struct shmseg *seg;
+	unsigned index;
+
+	/* Id 0 would make shm_find match by key. */
+	if (id <= 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(shm_lock);
+	seg = shm_find(id, IPC_PRIVATE, &index);
+	if (seg == NULL) {
+		lock_release(shm_lock);
+		return EINVAL;
+	}
+
+	/* Nobody else can find it by key now. */
+	seg->sh_key = IPC_PRIVATE;
+	if (seg->sh_nattach == 0) {
+		array_remove(shm_segs, index);
+		shm_free(seg);
+	}
+	lock_release(shm_lock);
+	return 0;
+}
+
+struct shmseg *
+shm_attach(int id)
+{
+	struct shmseg *seg;
+
+	if (id <= 0) {
+		return NULL;
+	}
+
+	lock_acquire(shm_lock);
+	seg = shm_find(id, IPC_PRIVATE, NULL);
+	if (seg != NULL) {
+		seg->sh_nattach++;
+	}
+	lock_release(shm_lock);
+	return seg;
+}
+
+void
+shm_incref(struct shmseg *seg)
+{
+	lock_acquire(shm_lock);
+	KASSERT(seg->sh_nattach > 0);
+	seg->sh_nattach++;
+	lock_release(shm_lock);
+}
+
+void
+shm_detach(struct shmseg *seg)
+{
+	unsigned index;
+
+	lock_acquire(shm_lock);
+	KASSERT(seg->sh_nattach > 0);
+	seg->sh_nattach--;
+	if (seg->sh_nattach == 0) {
+		/* The last user is gone; so is the segment. */
+		shm_find(seg->sh_id, IPC_PRIVATE, &index);
+		KASSERT(array_get(shm_segs, index) == seg);
+		array_remove(shm_segs, index);
+		shm_free(seg);
+	}
+	lock_release(shm_lock);
+}
+
+size_t
+shm_npages(struct shmseg *seg)
+{
+	return seg->sh_npages;
+}
+
+struct vpage *
+shm_page(struct shmseg *seg, unsigned i)
+{
+	KASSERT(i < seg->sh_npages);
+	return seg->sh_pages[i];
+}
@@ -0,0 +1,162 @@
+/*
+ * Swap space on a raw disk.
+ *
+ * See swap.h for an overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <proc.h>
+#include <current.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+/* Name of the swap disk */
+#define SWAP_DEVICE	"lhd1raw:"
+
+static struct vnode *swap_vnode;	/* NULL if no swap disk */
+static struct bitmap *swap_map;		/* slots in use */
+static unsigned swap_nslots;
+static unsigned swap_nfree;
+
+/* Protects swap_map and swap_nfree */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: no %s (%s); paging disabled\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat of %s failed: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; paging disabled\n",
+			SWAP_DEVICE);
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: out of memory for the slot map\n");
+	}
+	swap_nfree = swap_nslots;
+
+	kprintf("swap: %s, %u slots (%uk)\n", SWAP_DEVICE, swap_nslots,
+		swap_nslots * PAGE_SIZE / 1024);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		KASSERT(swap_nfree > 0);
+		swap_nfree--;
+	}
+	spinlock_release(&swap_lock);
+
+	return result ? ENOSPC : 0;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	bitmap_unmark(swap_map, slot);
+	swap_nfree++;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Move one page between memory and the swap disk.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t paddr, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	spinlock_release(&swap_lock);
+
+	uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &u);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &u);
+	}
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		/* short transfer - shouldn't happen on a raw disk */
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_pagein(unsigned slot, paddr_t paddr)
+{
+	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	PROC_USAGE_INC(ru_swapins);
+	return swap_io(slot, paddr, UIO_READ);
+}
+
+int
+swap_pageout(unsigned slot, paddr_t paddr)
+{
+	vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	PROC_USAGE_INC(ru_swapouts);
+	return swap_io(slot, paddr, UIO_WRITE);
+}
@@ -0,0 +1,106 @@
+/*
+ * Text page cache.
+ *
+ * See textcache.h for an overview.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <vpage.h>
+#include <textcache.h>
+
+/*
+ * One cached page. Entries are hashed on the vnode and offset, and
+ * the page points back at its entry so it can be removed quickly.
+ */
+struct textpage {
+	struct vnode *tp_vnode;
+	off_t tp_offset;
+	size_t tp_len;
+	struct vpage *tp_page;
+	struct textpage *tp_next;	/* hash chain */
+};
+
+#define TEXTCACHE_SIZE	127
+
+static struct textpage *textcache[TEXTCACHE_SIZE];
+
+/* Protects textcache[] and vp_text in all pages */
+static struct spinlock textcache_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+textcache_hash(struct vnode *v, off_t offset)
+{
+	return ((uintptr_t)v / sizeof(void *) + offset / PAGE_SIZE)
+		% TEXTCACHE_SIZE;
+}
+
+struct vpage *
+textcache_lookup(struct vnode *v, off_t offset, size_t len)
+{
+	struct textpage *tp;
+	struct vpage *vp;
+
+	vp = NULL;
+	spinlock_acquire(&textcache_lock);
+	for (tp = textcache[textcache_hash(v, offset)]; tp != NULL;
+	     tp = tp->tp_next) {
+		if (tp->tp_vnode == v && tp->tp_offset == offset &&
+		    tp->tp_len == len &&
+		    vpage_tryincref(tp->tp_page)) {
+			/* (A page on its way out is skipped.) */
+			vp = tp->tp_page;
+			break;
+		}
+	}
+	spinlock_release(&textcache_lock);
+	return vp;
+}
+
+void
+textcache_insert(struct vnode *v, off_t offset, size_t len,
+		 struct vpage *vp)
+{
+	struct textpage *tp;
+	unsigned h;
+
+	KASSERT(vp->vp_text == NULL);
+
+	tp = kmalloc(sizeof(*tp));
+	if (tp == NULL) {
+		return;
+	}
+	tp->tp_vnode = v;
+	tp->tp_offset = offset;
+	tp->tp_len = len;
+	tp->tp_page = vp;
+
+	h = textcache_hash(v, offset);
+	spinlock_acquire(&textcache_lock);
+	tp->tp_next = textcache[h];
+	textcache[h] = tp;
+	vp->vp_text = tp;
+	spinlock_release(&textcache_lock);
+}
+
+void
+textcache_remove(struct vpage *vp)
+{
+	struct textpage *tp, **pp;
+
+	spinlock_acquire(&textcache_lock);
+	tp = vp->vp_text;
+	KASSERT(tp != NULL);
+	for (pp = &textcache[textcache_hash(tp->tp_vnode, tp->tp_offset)];
+	     *pp != tp; pp = &(*pp)->tp_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = tp->tp_next;
+	vp->vp_text = NULL;
+	spinlock_release(&textcache_lock);
+
+	kfree(tp);
+}
@@ -5,21 +5,26 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by turning interrupts off.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally.
  */
 
 #include <types.h>
 #include <lib.h>
-#include <synch.h>
 #include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <vm.h>
 #include <uw-vmstats.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
-
-struct spinlock stats_lock = SPINLOCK_INITIALIZER;
+/* Counters for tracking statistics, one set per CPU (indexed by
+ * c_number) so that counting doesn't need a lock every CPU contends
+ * for. With interrupts off nothing else can touch the current CPU's
+ * set. They are only added up when printed.
+ */
+static unsigned int stats_counts[MAXCPUS][VMSTAT_COUNT];
 
 /* Strings used in printing out the statistics */
 static const char *stats_names[] = {
@@ -33,6 +38,13 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "TLB Fault-around Loads",
+ /* 11 */ "Page Faults (Compressed)",
+ /* 12 */ "Compressed Stores",
+ /* 13 */ "Compressed Bytes",
+ /* 14 */ "Compress Rejects",
+ /* 15 */ "Compressed Spills",
+ /* 16 */ "TLB Fault-around Misses",
 };
 
 
@@ -41,23 +53,37 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
+    int spl;
+
+    spl = splhigh();
       _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+    splx(spl);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Assumes vmstat_init has already been called */
+void
+vmstats_add(unsigned int index, unsigned int amount)
+{
+    int spl;
+
+    spl = splhigh();
+      _vmstats_add(index, amount);
+    splx(spl);
 }
 
 /* ---------------------------------------------------------------------- */
+/* This may also be used to reset the stats without shutting down the kernel.
+ * Counts made on other CPUs while it runs may survive the reset.
+ */
 void
 vmstats_init(void)
 {
-  /* Although the spinlock is initialized at declaration time we do it here
-   * again in case we want use/reset these stats repeatedly without shutting down the kernel.
-   */
-  spinlock_init(&stats_lock);
+  int spl;
 
-  spinlock_acquire(&stats_lock);
+  spl = splhigh();
     _vmstats_init();
-  spinlock_release(&stats_lock);
+  splx(spl);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +91,15 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  stats_counts[curcpu->c_number][index]++;
+}
+
+/* ---------------------------------------------------------------------- */
+void
+_vmstats_add(unsigned int index, unsigned int amount)
+{
+  KASSERT(index < VMSTAT_COUNT);
+  stats_counts[curcpu->c_number][index] += amount;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -73,6 +107,7 @@ void
 _vmstats_init(void)
 {
   int i = 0;
+  int c = 0;
 
   if (sizeof(stats_names) / sizeof(char *) != VMSTAT_COUNT) {
     kprintf("vmstats_init: number of stats_names = %d != VMSTAT_COUNT = %d\n",
@@ -80,40 +115,53 @@ _vmstats_init(void)
     panic("Should really fix this before proceeding\n");
   }
 
-  for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+  for (c=0; c<MAXCPUS; c++) {
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      stats_counts[c][i] = 0;
+    }
   }
 
 }
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
-/* NOTE: We do not grab the spinlock here because kprintf may block
- * and we can't block while holding a spinlock.
+/* NOTE: We do not turn interrupts off here because kprintf may block.
  * Just use this when there is only one thread remaining.
  */
 
 void
 vmstats_print(void)
 {
+  unsigned int stats_total[VMSTAT_COUNT];
+  int c = 0;
   int i = 0;
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  int stores = 0;
+  int evictions = 0;
+
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    stats_total[i] = 0;
+    for (c=0; c<MAXCPUS; c++) {
+      stats_total[i] += stats_counts[c][i];
+    }
+  }
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
-    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_counts[i]);
+    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_total[i]);
   }
 
-  tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
-  free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
-  disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
-  disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
+  tlb_faults = stats_total[VMSTAT_TLB_FAULT];
+  free_plus_replace = stats_total[VMSTAT_TLB_FAULT_FREE] + stats_total[VMSTAT_TLB_FAULT_REPLACE];
+  disk_plus_zeroed_plus_reload = stats_total[VMSTAT_PAGE_FAULT_DISK] +
+    stats_total[VMSTAT_PAGE_FAULT_ZERO] + stats_total[VMSTAT_TLB_RELOAD] +
+    stats_total[VMSTAT_PAGE_FAULT_COMPRESSED];
+  elf_plus_swap_reads = stats_total[VMSTAT_ELF_FILE_READ] + stats_total[VMSTAT_SWAP_FILE_READ];
+  disk_reads = stats_total[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
   if (tlb_faults != free_plus_replace) {
@@ -121,10 +169,10 @@ vmstats_print(void)
       tlb_faults, free_plus_replace); 
   }
 
-  kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) = %d\n",
+  kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) + Page Faults (Compressed) = %d\n",
     disk_plus_zeroed_plus_reload);
   if (tlb_faults != disk_plus_zeroed_plus_reload) {
-    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) (%d)\n",
+    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) + Page Faults (Compressed) (%d)\n",
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
@@ -133,5 +181,34 @@ vmstats_print(void)
     kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
       elf_plus_swap_reads);
   }
+
+  /* Derived figures for the compressed store */
+  stores = stats_total[VMSTAT_ZPOOL_STORE];
+  evictions = stores + stats_total[VMSTAT_SWAP_FILE_WRITE] -
+    stats_total[VMSTAT_ZPOOL_SPILL];
+  if (stores > 0) {
+    kprintf("VMSTAT Compression ratio = %d%% of original size\n",
+      (int)((unsigned long long)stats_total[VMSTAT_ZPOOL_BYTES] * 100 /
+            ((unsigned long long)stores * PAGE_SIZE)));
+  }
+  if (evictions > 0) {
+    kprintf("VMSTAT Evictions kept compressed = %d%%\n",
+      stores * 100 / evictions);
+  }
+  if (stats_total[VMSTAT_PAGE_FAULT_COMPRESSED] +
+      stats_total[VMSTAT_SWAP_FILE_READ] > 0) {
+    kprintf("VMSTAT Page-ins from compressed store = %d%%\n",
+      stats_total[VMSTAT_PAGE_FAULT_COMPRESSED] * 100 /
+      (stats_total[VMSTAT_PAGE_FAULT_COMPRESSED] +
+       stats_total[VMSTAT_SWAP_FILE_READ]));
+  }
+
+  /* Derived figure for fault-around (see vm.h) */
+  if (stats_total[VMSTAT_FAULTAROUND_LOAD] > 0) {
+    kprintf("VMSTAT Fault-around loads used (at most) = %d%%\n",
+      (stats_total[VMSTAT_FAULTAROUND_LOAD] -
+       stats_total[VMSTAT_FAULTAROUND_MISS]) * 100 /
+      stats_total[VMSTAT_FAULTAROUND_LOAD]);
+  }
 }
 /* ---------------------------------------------------------------------- */
@@ -0,0 +1,529 @@
+/*
+ * VM system: kernel page allocation and user page faults.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <vpage.h>
+#include <swap.h>
+#include <zpool.h>
+#include <textcache.h>
+#include <vmpolicy.h>
+#include <pagemerge.h>
+#include <shm.h>
+#include <uw-vmstats.h>
+
+unsigned vm_faultaround = VM_FAULTAROUND_DEFAULT;
+
+/*
+ * Page-ins between recounts of a process's resident pages. A process
+ * can't grow by more than this unnoticed, so its peak is at most this
+ * many pages short.
+ */
+#define VM_RSS_SAMPLE	16
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vmpolicy_bootstrap();
+	vmstats_init();
+	vpage_bootstrap();
+	swap_bootstrap();
+	zpool_bootstrap();
+	coremap_startzeroing();
+	pagemerge_bootstrap();
+	shm_bootstrap();
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+
+	pa = coremap_alloc(npages);
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * TLB shootdown, on the receiving end: another CPU has taken the frame
+ * away from a page, or made it read-only, and wants our entries for it
+ * gone (tlb_shootdown_paddr). Too many at once and we get asked to
+ * flush everything instead.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	tlb_flush();
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	tlb_invalidate_paddr(ts->ts_paddr);
+}
+
+void
+vm_updateusage(struct addrspace *as)
+{
+	struct rusage *ru = &curproc->p_usage;
+
+	ru->ru_rss = as_residentpages(as) * (PAGE_SIZE / 1024);
+	if (ru->ru_rss > ru->ru_maxrss) {
+		ru->ru_maxrss = ru->ru_rss;
+	}
+	ru->ru_minflt = ru->ru_reloads + ru->ru_zerofaults +
+		ru->ru_zpoolfaults;
+	ru->ru_majflt = ru->ru_filefaults + ru->ru_swapfaults;
+	curproc->p_rsssample = 0;
+}
+
+/*
+ * Note that the current process, whose address space AS is locked,
+ * has had a frame filled for it, and recount its resident pages every
+ * VM_RSS_SAMPLE times. Counting them on every fault would cost as much
+ * as the fault; keeping an exact count would mean finding every
+ * process that maps a page whenever one is evicted.
+ */
+static
+void
+vm_notepagein(struct addrspace *as)
+{
+	if (curproc == kproc) {
+		return;
+	}
+	if (++curproc->p_rsssample >= VM_RSS_SAMPLE) {
+		vm_updateusage(as);
+	}
+}
+
+/*
+ * Count a page filled from its file, if FROMFILE, or with zeros
+ * otherwise, either on first touch or after being dropped while clean.
+ */
+static
+void
+vm_notefill(bool fromfile)
+{
+	if (fromfile) {
+		/* (This includes mmap'd files.) */
+		vmstats_inc(VMSTAT_ELF_FILE_READ);
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		PROC_USAGE_INC(ru_filefaults);
+	}
+	else {
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		PROC_USAGE_INC(ru_zerofaults);
+	}
+}
+
+/*
+ * Give AS a private copy of the shared page VP mapped at VADDR, so it
+ * can be written, and hand back the page now mapped there in RET. VP
+ * must be locked and resident; the new page comes back locked, and VP
+ * is unlocked.
+ */
+static
+int
+vm_unshare(struct addrspace *as, vaddr_t vaddr, struct vpage *vp,
+	   struct vpage **ret)
+{
+	struct vpage *newvp, *oldvp;
+	int result;
+
+	newvp = vpage_copy(vp);
+	if (newvp == NULL) {
+		return ENOMEM;
+	}
+
+	oldvp = pt_remove(as->as_pt, vaddr);
+	KASSERT(oldvp == vp);
+	result = pt_insert(as->as_pt, vaddr, newvp);
+	/* The second-level table is still there, so this cannot fail. */
+	KASSERT(result == 0);
+
+	vpage_unlock(vp);
+	vpage_decref(vp);
+	*ret = newvp;
+	return 0;
+}
+
+/*
+ * Decide whether VP, which is resident, may be mapped writable. The
+ * caller holds vp_lock. CANWRITE says whether the region allows
+ * writing at all, and SHARED whether it's a MAP_SHARED region.
+ *
+ * A page with a copy in swap isn't writable, or the copy would go
+ * stale; nor is a page not yet marked modified, or eviction would
+ * drop changes it doesn't know about. Nor is a private page anyone
+ * else can see, which has to be copied first; a page of a shared
+ * region doesn't get copied. Anything not writable comes back to
+ * vm_fault as VM_FAULT_READONLY on the first write.
+ */
+static
+bool
+vm_writable(struct vpage *vp, bool canwrite, bool shared)
+{
+	if (!canwrite || vp->vp_swapslot != SWAP_NOSLOT ||
+	    !vp->vp_modified) {
+		return false;
+	}
+	return shared || vp->vp_refcount == 1;
+}
+
+/*
+ * Fast path for a TLB miss on a page that is resident and not busy,
+ * which is most of them: load the mapping holding only the page's
+ * spinlock, which keeps the busy lock (and so any paging or
+ * copy-on-write activity) away while we look. Returns false if the
+ * slow path is needed.
+ */
+static
+bool
+vm_fastreload(struct vpage *vp, vaddr_t vaddr, int faulttype,
+	      bool canwrite, bool shared)
+{
+	bool writable;
+
+	spinlock_acquire(&vp->vp_lock);
+	if (vp->vp_busy || vp->vp_paddr == 0) {
+		spinlock_release(&vp->vp_lock);
+		return false;
+	}
+	writable = vm_writable(vp, canwrite, shared);
+	if (faulttype == VM_FAULT_WRITE && !writable) {
+		/* Needs a copy, or to give up its swap slot. */
+		spinlock_release(&vp->vp_lock);
+		return false;
+	}
+	vp->vp_referenced = true;
+	tlb_insert(vaddr, vp->vp_paddr, writable);
+	spinlock_release(&vp->vp_lock);
+
+	vmstats_inc(VMSTAT_TLB_RELOAD);
+	PROC_USAGE_INC(ru_reloads);
+	return true;
+}
+
+/*
+ * Fault-around: after a TLB miss at VADDR has been handled, load
+ * entries for the other pages in the aligned window of vm_faultaround
+ * pages around it that are resident and can be mapped without the
+ * busy lock. Pages that aren't there or are busy are skipped; this
+ * never creates, reads, or copies a page.
+ */
+static
+void
+vm_faultaround_load(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vpage *vp;
+	vaddr_t va, start;
+	unsigned n, i;
+	bool canread, canwrite, shared, writable, loaded;
+
+	n = vm_faultaround;
+	if (n <= 1) {
+		return;
+	}
+	start = vaddr & ~(vaddr_t)(n * PAGE_SIZE - 1);
+	if (start != as->as_fabase) {
+		/* Forget the last window; only one is tracked. */
+		as->as_fabase = start;
+		as->as_faloaded = 0;
+	}
+
+	for (i=0; i<n; i++) {
+		va = start + i * PAGE_SIZE;
+		if (va == vaddr || va >= USERSPACETOP) {
+			continue;
+		}
+		vp = pt_lookup(as->as_pt, va);
+		if (vp == NULL) {
+			continue;
+		}
+		as_pageaccess(as, va, &canread, &canwrite, &shared);
+		if (!canread) {
+			continue;
+		}
+
+		spinlock_acquire(&vp->vp_lock);
+		if (vp->vp_busy || vp->vp_paddr == 0) {
+			spinlock_release(&vp->vp_lock);
+			continue;
+		}
+		writable = vm_writable(vp, canwrite, shared);
+		/* Not marked referenced: nobody has used it yet. */
+		loaded = tlb_preload(va, vp->vp_paddr, writable);
+		spinlock_release(&vp->vp_lock);
+
+		if (loaded) {
+			vmstats_inc(VMSTAT_FAULTAROUND_LOAD);
+			as->as_faloaded |= (uint32_t)1 << i;
+		}
+	}
+}
+
+/*
+ * Note a TLB miss at VADDR. If the last fault-around loaded an entry
+ * for it, that entry was evicted or shot down before it was used.
+ */
+static
+void
+vm_faultaround_miss(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t bit;
+
+	if (vaddr < as->as_fabase ||
+	    vaddr >= as->as_fabase + VM_FAULTAROUND_MAX * PAGE_SIZE) {
+		return;
+	}
+	bit = (uint32_t)1 << ((vaddr - as->as_fabase) / PAGE_SIZE);
+	if (as->as_faloaded & bit) {
+		as->as_faloaded &= ~bit;
+		vmstats_inc(VMSTAT_FAULTAROUND_MISS);
+	}
+}
+
+/*
+ * The body of vm_fault, called with AS's lock held.
+ */
+static
+int
+vm_handlefault(struct addrspace *as, int faulttype, vaddr_t faultaddress)
+{
+	struct vpage *vp;
+	struct vnode *textvn;
+	off_t textoff;
+	size_t textlen;
+	bool canread, canwrite, shared, cacheable, writable, fromfile;
+	bool compressed, dropped;
+	int result;
+
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+	if (!as_valid_addr(as, faultaddress)) {
+		/* Maybe just past the end of the stack */
+		result = as_growstack(as, faultaddress);
+		if (result) {
+			return result;
+		}
+	}
+
+	as_pageaccess(as, faultaddress, &canread, &canwrite, &shared);
+	if (!canread) {
+		/* PROT_NONE */
+		return EFAULT;
+	}
+	if (faulttype != VM_FAULT_READ && !canwrite) {
+		/* Write to read-only memory, such as the program's text */
+		return EFAULT;
+	}
+
+	if (faulttype != VM_FAULT_READONLY) {
+		/* A real TLB miss, as opposed to a write to a mapped page */
+		vmstats_inc(VMSTAT_TLB_FAULT);
+		PROC_USAGE_INC(ru_tlbfaults);
+		vm_faultaround_miss(as, faultaddress);
+	}
+
+	vp = pt_lookup(as->as_pt, faultaddress);
+	if (vp != NULL && faulttype != VM_FAULT_READONLY &&
+	    vm_fastreload(vp, faultaddress, faulttype, canwrite, shared)) {
+		vm_faultaround_load(as, faultaddress);
+		return 0;
+	}
+
+	cacheable = false;
+	if (vp == NULL &&
+	    as_cachekey(as, faultaddress, &textvn, &textoff, &textlen)) {
+		/*
+		 * Another process running this program, or mapping
+		 * this file shared, may have it.
+		 */
+		vp = textcache_lookup(textvn, textoff, textlen);
+		if (vp == NULL) {
+			cacheable = true;
+		}
+		else {
+			result = pt_insert(as->as_pt, faultaddress, vp);
+			if (result) {
+				vpage_decref(vp);
+				return result;
+			}
+		}
+	}
+
+	if (vp == NULL) {
+		/* Only pages that exist get mapped read-only. */
+		KASSERT(faulttype != VM_FAULT_READONLY);
+
+		/*
+		 * First touch: make a zero-filled page, and read in
+		 * whatever part of it comes from the executable or
+		 * mapped file.
+		 */
+		vp = vpage_create();
+		if (vp == NULL) {
+			return ENOMEM;
+		}
+		result = as_readpage(as, faultaddress, vp->vp_paddr, &fromfile);
+		if (result == 0) {
+			result = pt_insert(as->as_pt, faultaddress, vp);
+		}
+		if (result) {
+			vpage_unlock(vp);
+			vpage_decref(vp);
+			return result;
+		}
+		if (cacheable) {
+			textcache_insert(textvn, textoff, textlen, vp);
+		}
+		vm_notefill(fromfile);
+		vm_notepagein(as);
+	}
+	else {
+		vpage_lock(vp);
+		if (vp->vp_paddr == 0) {
+			compressed = vp->vp_zslot != ZPOOL_NOSLOT;
+			dropped = !compressed &&
+				vp->vp_swapslot == SWAP_NOSLOT;
+			result = vpage_pagein(vp);
+			if (result == 0 && dropped) {
+				/* Fill it again, as on first touch. */
+				result = as_readpage(as, faultaddress,
+						     vp->vp_paddr, &fromfile);
+				if (result) {
+					coremap_free(vp->vp_paddr);
+					vp->vp_paddr = 0;
+				}
+			}
+			if (result) {
+				vpage_unlock(vp);
+				return result;
+			}
+			if (faulttype != VM_FAULT_READONLY && dropped) {
+				vm_notefill(fromfile);
+			}
+			else if (faulttype != VM_FAULT_READONLY) {
+				vmstats_inc(compressed ?
+					    VMSTAT_PAGE_FAULT_COMPRESSED :
+					    VMSTAT_PAGE_FAULT_DISK);
+				if (compressed) {
+					PROC_USAGE_INC(ru_zpoolfaults);
+				}
+				else {
+					PROC_USAGE_INC(ru_swapfaults);
+				}
+			}
+			vm_notepagein(as);
+		}
+		else if (faulttype != VM_FAULT_READONLY) {
+			vmstats_inc(VMSTAT_TLB_RELOAD);
+			PROC_USAGE_INC(ru_reloads);
+		}
+	}
+
+	if (faulttype != VM_FAULT_READ) {
+		/*
+		 * Copy-on-write. A write to a shared page gets a
+		 * private copy first, unless the region is MAP_SHARED.
+		 * If the page has stopped being shared since its TLB
+		 * entry was loaded (the other side copied it already),
+		 * it is ours to write.
+		 */
+		if (!shared && vpage_isshared(vp)) {
+			result = vm_unshare(as, faultaddress, vp, &vp);
+			if (result) {
+				vpage_unlock(vp);
+				return result;
+			}
+			PROC_USAGE_INC(ru_cowfaults);
+			vm_notepagein(as);
+		}
+		vpage_setdirty(vp);
+		vp->vp_modified = true;
+	}
+
+	spinlock_acquire(&vp->vp_lock);
+	writable = vm_writable(vp, canwrite, shared);
+	spinlock_release(&vp->vp_lock);
+	vp->vp_referenced = true;
+
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, vp->vp_paddr);
+	tlb_insert(faultaddress, vp->vp_paddr, writable);
+
+	vpage_unlock(vp);
+
+	if (faulttype != VM_FAULT_READONLY) {
+		vm_faultaround_load(as, faultaddress);
+	}
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	bool locked;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	/*
+	 * The page merging thread may change our page table, so keep
+	 * it out throughout. This only takes as_lock if it's already
+	 * scanning us.
+	 */
+	locked = as_faultbegin(as);
+	result = vm_handlefault(as, faulttype, faultaddress);
+	as_faultend(as, locked);
+	return result;
+}
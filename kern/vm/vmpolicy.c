@@ -0,0 +1,303 @@
+/*
+ * Page replacement policies.
+ *
+ * See vmpolicy.h for the interface.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <coremap.h>
+#include <vmpolicy.h>
+
+static unsigned policy_nframes;
+
+////////////////////////////////////////////////////////////
+//
+// FIFO: evict the page that has been in memory longest, used or not.
+// User frames are kept on a list in the order they were filled.
+
+static unsigned *fifo_next, *fifo_prev;
+static unsigned fifo_head, fifo_tail;
+
+static
+int
+fifo_init(unsigned nframes)
+{
+	fifo_next = kmalloc(nframes * sizeof(unsigned));
+	fifo_prev = kmalloc(nframes * sizeof(unsigned));
+	if (fifo_next == NULL || fifo_prev == NULL) {
+		kfree(fifo_next);
+		kfree(fifo_prev);
+		return ENOMEM;
+	}
+	fifo_head = fifo_tail = VMPOLICY_NONE;
+	return 0;
+}
+
+static
+void
+fifo_reset(void)
+{
+	fifo_head = fifo_tail = VMPOLICY_NONE;
+}
+
+static
+void
+fifo_add(unsigned frame)
+{
+	fifo_next[frame] = VMPOLICY_NONE;
+	fifo_prev[frame] = fifo_tail;
+	if (fifo_tail != VMPOLICY_NONE) {
+		fifo_next[fifo_tail] = frame;
+	}
+	else {
+		fifo_head = frame;
+	}
+	fifo_tail = frame;
+}
+
+static
+void
+fifo_remove(unsigned frame)
+{
+	if (fifo_prev[frame] != VMPOLICY_NONE) {
+		fifo_next[fifo_prev[frame]] = fifo_next[frame];
+	}
+	else {
+		KASSERT(fifo_head == frame);
+		fifo_head = fifo_next[frame];
+	}
+	if (fifo_next[frame] != VMPOLICY_NONE) {
+		fifo_prev[fifo_next[frame]] = fifo_prev[frame];
+	}
+	else {
+		KASSERT(fifo_tail == frame);
+		fifo_tail = fifo_prev[frame];
+	}
+}
+
+static
+unsigned
+fifo_choose(void)
+{
+	unsigned i;
+
+	/* The oldest one we can lock. */
+	for (i = fifo_head; i != VMPOLICY_NONE; i = fifo_next[i]) {
+		if (coremap_lockframe(i)) {
+			return i;
+		}
+	}
+	return VMPOLICY_NONE;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Clock: sweep a hand over the frames; a page used since the hand
+// last passed has its flag cleared and is skipped.
+
+static unsigned clock_hand;
+
+static
+int
+clock_init(unsigned nframes)
+{
+	(void)nframes;
+	clock_hand = 0;
+	return 0;
+}
+
+static
+void
+clock_reset(void)
+{
+	/* Nothing: the hand can start anywhere. */
+}
+
+static
+void
+clock_add(unsigned frame)
+{
+	(void)frame;
+}
+
+static
+void
+clock_remove(unsigned frame)
+{
+	(void)frame;
+}
+
+static
+unsigned
+clock_choose(void)
+{
+	unsigned i, n;
+
+	/* Two sweeps: the first may only clear referenced flags. */
+	for (n=0; n<2*policy_nframes; n++) {
+		i = clock_hand;
+		clock_hand = (i + 1) % policy_nframes;
+
+		if (!coremap_lockframe(i)) {
+			continue;
+		}
+		if (coremap_testclearref(i)) {
+			/* Second chance */
+			coremap_unlockframe(i);
+			continue;
+		}
+		return i;
+	}
+	return VMPOLICY_NONE;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Aging: each frame has an 8-bit age; at each eviction every age is
+// shifted right with the page's referenced flag shifted in at the top,
+// and the frame with the lowest age goes. This approximates LRU with
+// eight steps of history. Newly filled frames start with the top bit
+// set, as if just used.
+
+static unsigned char *aging_ages;
+
+static
+int
+aging_init(unsigned nframes)
+{
+	aging_ages = kmalloc(nframes);
+	if (aging_ages == NULL) {
+		return ENOMEM;
+	}
+	bzero(aging_ages, nframes);
+	return 0;
+}
+
+static
+void
+aging_reset(void)
+{
+	bzero(aging_ages, policy_nframes);
+}
+
+static
+void
+aging_add(unsigned frame)
+{
+	aging_ages[frame] = 0x80;
+}
+
+static
+void
+aging_remove(unsigned frame)
+{
+	aging_ages[frame] = 0;
+}
+
+static
+unsigned
+aging_choose(void)
+{
+	unsigned i, best;
+
+	/* Age everything we can look at. */
+	for (i=0; i<policy_nframes; i++) {
+		if (!coremap_lockframe(i)) {
+			continue;
+		}
+		aging_ages[i] >>= 1;
+		if (coremap_testclearref(i)) {
+			aging_ages[i] |= 0x80;
+		}
+		coremap_unlockframe(i);
+	}
+
+	/* Keep the youngest candidate so far locked. */
+	best = VMPOLICY_NONE;
+	for (i=0; i<policy_nframes; i++) {
+		if (best != VMPOLICY_NONE && aging_ages[i] >= aging_ages[best]) {
+			continue;
+		}
+		if (!coremap_lockframe(i)) {
+			continue;
+		}
+		if (best != VMPOLICY_NONE) {
+			coremap_unlockframe(best);
+		}
+		best = i;
+		if (aging_ages[i] == 0) {
+			break;
+		}
+	}
+	return best;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Policy table
+
+static const struct vmpolicy vmpolicies[] = {
+	{ "clock", clock_init, clock_reset, clock_add, clock_remove,
+	  clock_choose },
+	{ "fifo", fifo_init, fifo_reset, fifo_add, fifo_remove,
+	  fifo_choose },
+	{ "aging", aging_init, aging_reset, aging_add, aging_remove,
+	  aging_choose },
+};
+
+#define NPOLICIES	(sizeof(vmpolicies) / sizeof(vmpolicies[0]))
+
+/* The first one is the default. */
+static const struct vmpolicy *policy_current;
+
+void
+vmpolicy_bootstrap(void)
+{
+	unsigned i, used;
+	int result;
+
+	coremap_getstats(&used, &policy_nframes);
+	for (i=0; i<NPOLICIES; i++) {
+		result = vmpolicies[i].vmp_init(policy_nframes);
+		if (result) {
+			panic("vmpolicy: %s: %s\n", vmpolicies[i].vmp_name,
+			      strerror(result));
+		}
+	}
+	policy_current = &vmpolicies[0];
+	coremap_setpolicy(policy_current);
+}
+
+int
+vmpolicy_select(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<NPOLICIES; i++) {
+		if (!strcmp(vmpolicies[i].vmp_name, name)) {
+			policy_current = &vmpolicies[i];
+			coremap_setpolicy(policy_current);
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+const char *
+vmpolicy_current(void)
+{
+	return policy_current->vmp_name;
+}
+
+void
+vmpolicy_list(void)
+{
+	unsigned i;
+
+	for (i=0; i<NPOLICIES; i++) {
+		kprintf("%s%s", i > 0 ? " " : "", vmpolicies[i].vmp_name);
+	}
+	kprintf("\n");
+}
@@ -0,0 +1,329 @@
+/*
+ * Logical pages of user memory.
+ *
+ * See vpage.h for an overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <zpool.h>
+#include <vpage.h>
+#include <textcache.h>
+
+/*
+ * Threads waiting for a busy page. Pages are rarely contended, so
+ * they share one channel rather than each carrying its own.
+ */
+static struct wchan *vpage_wchan;
+
+void
+vpage_bootstrap(void)
+{
+	vpage_wchan = wchan_create("vpage");
+	if (vpage_wchan == NULL) {
+		panic("vpage_bootstrap: out of memory\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Busy lock
+
+void
+vpage_lock(struct vpage *vp)
+{
+	spinlock_acquire(&vp->vp_lock);
+	while (vp->vp_busy) {
+		vp->vp_wanted = true;
+		/* Bridge to the wchan lock; wchan_sleep unlocks it. */
+		wchan_lock(vpage_wchan);
+		spinlock_release(&vp->vp_lock);
+		wchan_sleep(vpage_wchan);
+		spinlock_acquire(&vp->vp_lock);
+	}
+	vp->vp_busy = true;
+	spinlock_release(&vp->vp_lock);
+}
+
+bool
+vpage_trylock(struct vpage *vp)
+{
+	bool gotit;
+
+	spinlock_acquire(&vp->vp_lock);
+	gotit = !vp->vp_busy;
+	vp->vp_busy = true;
+	spinlock_release(&vp->vp_lock);
+	return gotit;
+}
+
+void
+vpage_unlock(struct vpage *vp)
+{
+	bool wanted;
+
+	spinlock_acquire(&vp->vp_lock);
+	KASSERT(vp->vp_busy);
+	vp->vp_busy = false;
+	wanted = vp->vp_wanted;
+	vp->vp_wanted = false;
+	spinlock_release(&vp->vp_lock);
+
+	if (wanted) {
+		wchan_wakeall(vpage_wchan);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Creation and destruction
+
+/*
+ * Common part of vpage_create and vpage_copy: a locked page with a
+ * frame that is zero-filled if ZERO is set, and otherwise has
+ * contents not yet set.
+ */
+static
+struct vpage *
+vpage_alloc(bool zero)
+{
+	struct vpage *vp;
+
+	vp = kmalloc(sizeof(*vp));
+	if (vp == NULL) {
+		return NULL;
+	}
+
+	vp->vp_paddr = 0;
+	vp->vp_swapslot = SWAP_NOSLOT;
+	vp->vp_zslot = ZPOOL_NOSLOT;
+	vp->vp_zfill = 0;
+	vp->vp_referenced = false;
+	vp->vp_modified = false;
+	vp->vp_busy = true;
+	vp->vp_wanted = false;
+	vp->vp_refcount = 1;
+	vp->vp_text = NULL;
+	spinlock_init(&vp->vp_lock);
+
+	/* The coremap can see VP from here on, but it's locked. */
+	vp->vp_paddr = coremap_alloc_user(vp, zero);
+	if (vp->vp_paddr == 0) {
+		spinlock_cleanup(&vp->vp_lock);
+		kfree(vp);
+		return NULL;
+	}
+	return vp;
+}
+
+static
+void
+vpage_destroy(struct vpage *vp)
+{
+	KASSERT(vp->vp_refcount == 0);
+
+	if (vp->vp_text != NULL) {
+		textcache_remove(vp);
+	}
+
+	/* Wait out any eviction in progress. */
+	vpage_lock(vp);
+
+	if (vp->vp_paddr != 0) {
+		coremap_free(vp->vp_paddr);
+	}
+	if (vp->vp_swapslot != SWAP_NOSLOT) {
+		swap_free(vp->vp_swapslot);
+	}
+	if (vp->vp_zslot != ZPOOL_NOSLOT) {
+		zpool_drop(vp);
+	}
+	spinlock_cleanup(&vp->vp_lock);
+	kfree(vp);
+}
+
+struct vpage *
+vpage_create(void)
+{
+	/* Usually from the pool the zeroing thread keeps filled. */
+	return vpage_alloc(true);
+}
+
+struct vpage *
+vpage_copy(struct vpage *vp)
+{
+	struct vpage *newvp;
+
+	KASSERT(vp->vp_busy);
+	KASSERT(vp->vp_paddr != 0);
+
+	newvp = vpage_alloc(false);
+	if (newvp == NULL) {
+		return NULL;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newvp->vp_paddr),
+		(const void *)PADDR_TO_KVADDR(vp->vp_paddr),
+		PAGE_SIZE);
+	/* Nothing could fill it again. */
+	newvp->vp_modified = true;
+	return newvp;
+}
+
+void
+vpage_incref(struct vpage *vp)
+{
+	spinlock_acquire(&vp->vp_lock);
+	KASSERT(vp->vp_refcount > 0);
+	vp->vp_refcount++;
+	spinlock_release(&vp->vp_lock);
+}
+
+bool
+vpage_tryincref(struct vpage *vp)
+{
+	bool gotit;
+
+	spinlock_acquire(&vp->vp_lock);
+	gotit = vp->vp_refcount > 0;
+	if (gotit) {
+		vp->vp_refcount++;
+	}
+	spinlock_release(&vp->vp_lock);
+	return gotit;
+}
+
+void
+vpage_decref(struct vpage *vp)
+{
+	unsigned refcount;
+
+	spinlock_acquire(&vp->vp_lock);
+	KASSERT(vp->vp_refcount > 0);
+	refcount = --vp->vp_refcount;
+	spinlock_release(&vp->vp_lock);
+
+	if (refcount == 0) {
+		vpage_destroy(vp);
+	}
+}
+
+bool
+vpage_isshared(struct vpage *vp)
+{
+	bool shared;
+
+	spinlock_acquire(&vp->vp_lock);
+	shared = vp->vp_refcount > 1;
+	spinlock_release(&vp->vp_lock);
+	return shared;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Paging
+
+int
+vpage_pagein(struct vpage *vp)
+{
+	paddr_t pa;
+	bool dropped;
+	int result;
+
+	KASSERT(vp->vp_busy);
+
+	if (vp->vp_paddr != 0) {
+		return 0;
+	}
+
+	dropped = vp->vp_zslot == ZPOOL_NOSLOT &&
+		vp->vp_swapslot == SWAP_NOSLOT;
+	pa = coremap_alloc_user(vp, dropped);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+
+	if (vp->vp_zslot != ZPOOL_NOSLOT) {
+		/* Comes back dirty: the compressed copy is gone. */
+		zpool_load(vp, pa);
+		vp->vp_paddr = pa;
+		return 0;
+	}
+
+	if (dropped) {
+		/* Evicted while clean; the caller fills it again. */
+		KASSERT(!vp->vp_modified);
+		vp->vp_paddr = pa;
+		return 0;
+	}
+
+	result = swap_pagein(vp->vp_swapslot, pa);
+	if (result) {
+		coremap_free(pa);
+		return result;
+	}
+
+	/* Keep the slot: until it's written, the page is clean. */
+	vp->vp_paddr = pa;
+	return 0;
+}
+
+int
+vpage_evict(struct vpage *vp)
+{
+	unsigned slot;
+	int result;
+
+	KASSERT(vp->vp_busy);
+	KASSERT(vp->vp_paddr != 0);
+
+	/*
+	 * Get rid of any TLB mapping first, on every CPU, so nothing
+	 * can write the page while it's being copied out.
+	 */
+	tlb_shootdown_paddr(vp->vp_paddr);
+
+	/*
+	 * A page that isn't modified is just as it was read from its
+	 * file or zero-filled, and the fault path can do that again,
+	 * so it's dropped without saving it anywhere.
+	 */
+	if (vp->vp_modified && vp->vp_swapslot == SWAP_NOSLOT &&
+	    (!zpool_enabled() || zpool_store(vp) != 0)) {
+		/* Dirty, and didn't compress: off to swap. */
+		if (!swap_enabled()) {
+			return ENOSPC;
+		}
+		result = swap_alloc(&slot);
+		if (result) {
+			return result;
+		}
+		result = swap_pageout(slot, vp->vp_paddr);
+		if (result) {
+			swap_free(slot);
+			return result;
+		}
+		vp->vp_swapslot = slot;
+	}
+
+	vp->vp_paddr = 0;
+	vp->vp_referenced = false;
+	return 0;
+}
+
+void
+vpage_setdirty(struct vpage *vp)
+{
+	KASSERT(vp->vp_busy);
+	KASSERT(vp->vp_paddr != 0);
+
+	if (vp->vp_swapslot != SWAP_NOSLOT) {
+		swap_free(vp->vp_swapslot);
+		vp->vp_swapslot = SWAP_NOSLOT;
+	}
+}
@@ -0,0 +1,548 @@
+/*
+ * Compressed page store.
+ *
+ * See zpool.h for an overview.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vpage.h>
+#include <zpool.h>
+#include <uw-vmstats.h>
+
+#define ZPOOL_CHUNKSIZE		256
+#define ZPOOL_CHUNKS		(PAGE_SIZE / ZPOOL_CHUNKSIZE)	/* per frame */
+#define ZPOOL_MAXCHUNKS		(ZPOOL_CHUNKS * 3 / 4)		/* per page */
+#define ZPOOL_MAXBYTES		(ZPOOL_MAXCHUNKS * ZPOOL_CHUNKSIZE)
+
+#define ZPOOL_NONE		((unsigned)-1)
+
+/*
+ * A frame of the store, with a bitmap of the chunks in use. Frames
+ * are returned to the coremap when they empty.
+ */
+struct zframe {
+	paddr_t zf_paddr;	/* 0 if not allocated */
+	uint32_t zf_used;	/* one bit per chunk */
+};
+
+/*
+ * A compressed page, indexed by the chunk it starts at (frame number
+ * times ZPOOL_CHUNKS plus chunk). Stored pages are kept on a list in
+ * the order they came in, so the oldest can be spilled to swap.
+ */
+struct zentry {
+	struct vpage *ze_owner;
+	unsigned ze_len;	/* compressed size in bytes */
+	unsigned ze_next;	/* list links (entry numbers) */
+	unsigned ze_prev;
+};
+
+static struct zframe *zpool_frames;
+static unsigned zpool_maxframes;
+static struct zentry *zpool_entries;
+static unsigned zpool_oldest, zpool_newest;
+
+/* Bounce page for spilling to swap */
+static vaddr_t zpool_bounce;
+
+/* Scratch space for the compressor */
+#define ZPOOL_HASHSIZE	1024
+static uint16_t zpool_hash[ZPOOL_HASHSIZE];
+static unsigned char zpool_buf[ZPOOL_MAXBYTES];
+
+/*
+ * Protects everything above. A sleep lock, since spilling does I/O.
+ * While holding it, other pages are only ever trylocked.
+ */
+static struct lock *zpool_lock;
+
+#define CHUNK_KVADDR(slot) \
+	(PADDR_TO_KVADDR(zpool_frames[(slot) / ZPOOL_CHUNKS].zf_paddr) + \
+	 ((slot) % ZPOOL_CHUNKS) * ZPOOL_CHUNKSIZE)
+
+void
+zpool_bootstrap(void)
+{
+	unsigned used, total, i;
+
+	coremap_getstats(&used, &total);
+	zpool_maxframes = total / 8;
+	if (zpool_maxframes == 0) {
+		zpool_maxframes = 1;
+	}
+
+	zpool_frames = kmalloc(zpool_maxframes * sizeof(struct zframe));
+	zpool_entries = kmalloc(zpool_maxframes * ZPOOL_CHUNKS *
+				sizeof(struct zentry));
+	zpool_bounce = alloc_kpages(1);
+	zpool_lock = lock_create("zpool");
+	if (zpool_frames == NULL || zpool_entries == NULL ||
+	    zpool_bounce == 0 || zpool_lock == NULL) {
+		panic("zpool_bootstrap: out of memory\n");
+	}
+	for (i=0; i<zpool_maxframes; i++) {
+		zpool_frames[i].zf_paddr = 0;
+		zpool_frames[i].zf_used = 0;
+	}
+	zpool_oldest = zpool_newest = ZPOOL_NONE;
+
+	kprintf("zpool: up to %u frames of compressed pages\n",
+		zpool_maxframes);
+}
+
+bool
+zpool_enabled(void)
+{
+	return zpool_lock != NULL;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Compression
+//
+// The compressed form is a series of tokens. A byte C below 0x80 is
+// followed by C+1 literal bytes. A byte C from 0x80 up means: copy
+// (C & 0x7f) + 3 bytes from the given distance back in the output,
+// which follows as two bytes, low byte first. Copies may overlap what
+// they produce, so a long run of one byte is a literal and a copy at
+// distance 1.
+
+#define LZ_MAXLITERAL	128
+#define LZ_MINMATCH	3
+#define LZ_MAXMATCH	(0x7f + LZ_MINMATCH)
+
+static
+unsigned
+lz_hash(const unsigned char *p)
+{
+	return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) % ZPOOL_HASHSIZE;
+}
+
+/*
+ * Append the literals SRC[START..END) to DST at *OP. Returns false if
+ * that would go past LIMIT.
+ */
+static
+bool
+lz_literals(const unsigned char *src, size_t start, size_t end,
+	    unsigned char *dst, size_t *op, size_t limit)
+{
+	size_t n;
+
+	while (start < end) {
+		n = end - start;
+		if (n > LZ_MAXLITERAL) {
+			n = LZ_MAXLITERAL;
+		}
+		if (*op + 1 + n > limit) {
+			return false;
+		}
+		dst[(*op)++] = n - 1;
+		memcpy(dst + *op, src + start, n);
+		*op += n;
+		start += n;
+	}
+	return true;
+}
+
+/*
+ * Compress the page SRC into DST. Returns the compressed size, or 0
+ * if it would be bigger than LIMIT.
+ */
+static
+size_t
+lz_compress(const unsigned char *src, unsigned char *dst, size_t limit)
+{
+	size_t ip, op, lit, ref, len;
+	unsigned h;
+
+	/* Positions are stored plus one, so 0 means none. */
+	bzero(zpool_hash, sizeof(zpool_hash));
+
+	ip = op = lit = 0;
+	while (ip + LZ_MINMATCH <= PAGE_SIZE) {
+		h = lz_hash(src + ip);
+		ref = zpool_hash[h];
+		zpool_hash[h] = ip + 1;
+		if (ref == 0 || src[ref-1] != src[ip] ||
+		    src[ref] != src[ip+1] || src[ref+1] != src[ip+2]) {
+			ip++;
+			continue;
+		}
+		ref--;
+
+		len = LZ_MINMATCH;
+		while (ip + len < PAGE_SIZE && len < LZ_MAXMATCH &&
+		       src[ref + len] == src[ip + len]) {
+			len++;
+		}
+
+		if (!lz_literals(src, lit, ip, dst, &op, limit) ||
+		    op + 3 > limit) {
+			return 0;
+		}
+		dst[op++] = 0x80 | (len - LZ_MINMATCH);
+		dst[op++] = (ip - ref) & 0xff;
+		dst[op++] = (ip - ref) >> 8;
+		ip += len;
+		lit = ip;
+	}
+	if (!lz_literals(src, lit, PAGE_SIZE, dst, &op, limit)) {
+		return 0;
+	}
+	return op;
+}
+
+static
+void
+lz_decompress(const unsigned char *src, size_t len, unsigned char *dst)
+{
+	size_t ip, op, n, dist, i;
+	unsigned char c;
+
+	ip = op = 0;
+	while (ip < len) {
+		c = src[ip++];
+		if (c < 0x80) {
+			n = c + 1;
+			KASSERT(ip + n <= len && op + n <= PAGE_SIZE);
+			memcpy(dst + op, src + ip, n);
+			ip += n;
+		}
+		else {
+			n = (c & 0x7f) + LZ_MINMATCH;
+			KASSERT(ip + 2 <= len);
+			dist = src[ip] | (src[ip+1] << 8);
+			ip += 2;
+			KASSERT(dist > 0 && dist <= op && op + n <= PAGE_SIZE);
+			/* Byte by byte: it may overlap. */
+			for (i=0; i<n; i++) {
+				dst[op + i] = dst[op + i - dist];
+			}
+		}
+		op += n;
+	}
+	KASSERT(op == PAGE_SIZE);
+}
+
+/*
+ * If the page at KVADDR is one word over and over, return true and
+ * the word.
+ */
+static
+bool
+zpool_samefilled(vaddr_t kvaddr, uint32_t *fill)
+{
+	const uint32_t *p = (const uint32_t *)kvaddr;
+	unsigned i;
+
+	for (i=1; i<PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (p[i] != p[0]) {
+			return false;
+		}
+	}
+	*fill = p[0];
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Chunks
+
+static
+uint32_t
+zpool_runmask(unsigned first, unsigned n)
+{
+	return ((n == 32 ? 0 : (uint32_t)1 << n) - 1) << first;
+}
+
+/*
+ * Find N free chunks in a row in one frame. Returns the slot, or
+ * ZPOOL_NONE.
+ */
+static
+unsigned
+zpool_findrun(unsigned n)
+{
+	unsigned f, c;
+
+	KASSERT(lock_do_i_hold(zpool_lock));
+
+	for (f=0; f<zpool_maxframes; f++) {
+		if (zpool_frames[f].zf_paddr == 0) {
+			continue;
+		}
+		for (c=0; c + n <= ZPOOL_CHUNKS; c++) {
+			if ((zpool_frames[f].zf_used &
+			     zpool_runmask(c, n)) == 0) {
+				return f * ZPOOL_CHUNKS + c;
+			}
+		}
+	}
+	return ZPOOL_NONE;
+}
+
+/*
+ * Add a frame to the store, if we're allowed more and the coremap
+ * has one. This mustn't evict anything, as we may be in the middle of
+ * an eviction already, so it can only use free memory.
+ */
+static
+bool
+zpool_grow(void)
+{
+	unsigned f;
+	paddr_t pa;
+
+	KASSERT(lock_do_i_hold(zpool_lock));
+
+	for (f=0; f<zpool_maxframes; f++) {
+		if (zpool_frames[f].zf_paddr == 0) {
+			break;
+		}
+	}
+	if (f == zpool_maxframes) {
+		return false;
+	}
+	pa = coremap_alloc_reserve();
+	if (pa == 0) {
+		return false;
+	}
+	zpool_frames[f].zf_paddr = pa;
+	zpool_frames[f].zf_used = 0;
+	return true;
+}
+
+/*
+ * Release the chunks of entry SLOT, and its frame if that empties.
+ */
+static
+void
+zpool_release(unsigned slot)
+{
+	struct zentry *ze = &zpool_entries[slot];
+	struct zframe *zf = &zpool_frames[slot / ZPOOL_CHUNKS];
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(zpool_lock));
+
+	n = DIVROUNDUP(ze->ze_len, ZPOOL_CHUNKSIZE);
+	KASSERT((zf->zf_used & zpool_runmask(slot % ZPOOL_CHUNKS, n)) ==
+		zpool_runmask(slot % ZPOOL_CHUNKS, n));
+	zf->zf_used &= ~zpool_runmask(slot % ZPOOL_CHUNKS, n);
+
+	if (ze->ze_prev != ZPOOL_NONE) {
+		zpool_entries[ze->ze_prev].ze_next = ze->ze_next;
+	}
+	else {
+		zpool_oldest = ze->ze_next;
+	}
+	if (ze->ze_next != ZPOOL_NONE) {
+		zpool_entries[ze->ze_next].ze_prev = ze->ze_prev;
+	}
+	else {
+		zpool_newest = ze->ze_prev;
+	}
+	ze->ze_owner = NULL;
+
+	if (zf->zf_used == 0) {
+		coremap_free(zf->zf_paddr);
+		zf->zf_paddr = 0;
+	}
+}
+
+/*
+ * Write the oldest compressed page we can lock out to swap, to make
+ * room. Returns false if there's nothing we can spill.
+ */
+static
+bool
+zpool_spill(void)
+{
+	struct vpage *vp;
+	unsigned slot, swapslot;
+	int result;
+
+	KASSERT(lock_do_i_hold(zpool_lock));
+
+	if (!swap_enabled()) {
+		return false;
+	}
+
+	for (slot = zpool_oldest; slot != ZPOOL_NONE;
+	     slot = zpool_entries[slot].ze_next) {
+		vp = zpool_entries[slot].ze_owner;
+		/* Only trylock: its owner might be waiting for us. */
+		if (vpage_trylock(vp)) {
+			break;
+		}
+	}
+	if (slot == ZPOOL_NONE) {
+		return false;
+	}
+	KASSERT(vp->vp_zslot == slot);
+	KASSERT(vp->vp_paddr == 0 && vp->vp_swapslot == SWAP_NOSLOT);
+
+	lz_decompress((const unsigned char *)CHUNK_KVADDR(slot),
+		      zpool_entries[slot].ze_len,
+		      (unsigned char *)zpool_bounce);
+	result = swap_alloc(&swapslot);
+	if (result == 0) {
+		result = swap_pageout(swapslot, KVADDR_TO_PADDR(zpool_bounce));
+		if (result) {
+			swap_free(swapslot);
+		}
+	}
+	if (result) {
+		vpage_unlock(vp);
+		return false;
+	}
+
+	vp->vp_swapslot = swapslot;
+	vp->vp_zslot = ZPOOL_NOSLOT;
+	zpool_release(slot);
+	vpage_unlock(vp);
+
+	vmstats_inc(VMSTAT_ZPOOL_SPILL);
+	return true;
+}
+
+/*
+ * Find room for N chunks, growing the store or spilling old pages to
+ * swap as needed. Returns the slot, or ZPOOL_NONE.
+ */
+static
+unsigned
+zpool_alloc(unsigned n)
+{
+	unsigned slot;
+
+	KASSERT(lock_do_i_hold(zpool_lock));
+
+	while (1) {
+		slot = zpool_findrun(n);
+		if (slot != ZPOOL_NONE) {
+			return slot;
+		}
+		if (!zpool_grow() && !zpool_spill()) {
+			return ZPOOL_NONE;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+int
+zpool_store(struct vpage *vp)
+{
+	struct zentry *ze;
+	vaddr_t kvaddr;
+	uint32_t fill;
+	size_t len;
+	unsigned n, slot;
+
+	KASSERT(vp->vp_busy);
+	KASSERT(vp->vp_paddr != 0);
+	KASSERT(vp->vp_swapslot == SWAP_NOSLOT);
+	KASSERT(vp->vp_zslot == ZPOOL_NOSLOT);
+
+	kvaddr = PADDR_TO_KVADDR(vp->vp_paddr);
+	if (zpool_samefilled(kvaddr, &fill)) {
+		vp->vp_zslot = ZPOOL_FILLED;
+		vp->vp_zfill = fill;
+		vmstats_inc(VMSTAT_ZPOOL_STORE);
+		return 0;
+	}
+
+	lock_acquire(zpool_lock);
+
+	len = lz_compress((const unsigned char *)kvaddr, zpool_buf,
+			  ZPOOL_MAXBYTES);
+	if (len == 0) {
+		lock_release(zpool_lock);
+		vmstats_inc(VMSTAT_ZPOOL_REJECT);
+		return ENOSPC;
+	}
+
+	n = DIVROUNDUP(len, ZPOOL_CHUNKSIZE);
+	slot = zpool_alloc(n);
+	if (slot == ZPOOL_NONE) {
+		lock_release(zpool_lock);
+		vmstats_inc(VMSTAT_ZPOOL_REJECT);
+		return ENOSPC;
+	}
+	zpool_frames[slot / ZPOOL_CHUNKS].zf_used |=
+		zpool_runmask(slot % ZPOOL_CHUNKS, n);
+	memcpy((void *)CHUNK_KVADDR(slot), zpool_buf, len);
+
+	ze = &zpool_entries[slot];
+	ze->ze_owner = vp;
+	ze->ze_len = len;
+	ze->ze_next = ZPOOL_NONE;
+	ze->ze_prev = zpool_newest;
+	if (zpool_newest != ZPOOL_NONE) {
+		zpool_entries[zpool_newest].ze_next = slot;
+	}
+	else {
+		zpool_oldest = slot;
+	}
+	zpool_newest = slot;
+	vp->vp_zslot = slot;
+
+	lock_release(zpool_lock);
+
+	vmstats_inc(VMSTAT_ZPOOL_STORE);
+	vmstats_add(VMSTAT_ZPOOL_BYTES, len);
+	return 0;
+}
+
+void
+zpool_load(struct vpage *vp, paddr_t paddr)
+{
+	uint32_t *p;
+	unsigned i, slot;
+
+	KASSERT(vp->vp_busy);
+	KASSERT(vp->vp_zslot != ZPOOL_NOSLOT);
+
+	slot = vp->vp_zslot;
+	if (slot == ZPOOL_FILLED) {
+		p = (uint32_t *)PADDR_TO_KVADDR(paddr);
+		for (i=0; i<PAGE_SIZE / sizeof(uint32_t); i++) {
+			p[i] = vp->vp_zfill;
+		}
+	}
+	else {
+		lock_acquire(zpool_lock);
+		KASSERT(zpool_entries[slot].ze_owner == vp);
+		lz_decompress((const unsigned char *)CHUNK_KVADDR(slot),
+			      zpool_entries[slot].ze_len,
+			      (unsigned char *)PADDR_TO_KVADDR(paddr));
+		zpool_release(slot);
+		lock_release(zpool_lock);
+	}
+	vp->vp_zslot = ZPOOL_NOSLOT;
+}
+
+void
+zpool_drop(struct vpage *vp)
+{
+	KASSERT(vp->vp_busy);
+	KASSERT(vp->vp_zslot != ZPOOL_NOSLOT);
+
+	if (vp->vp_zslot != ZPOOL_FILLED) {
+		lock_acquire(zpool_lock);
+		KASSERT(zpool_entries[vp->vp_zslot].ze_owner == vp);
+		zpool_release(vp->vp_zslot);
+		lock_release(zpool_lock);
+	}
+	vp->vp_zslot = ZPOOL_NOSLOT;
+}
@@ -0,0 +1,68 @@
+/*
+ * vmusage - run a program and report its virtual memory activity.
+ * Usage: vmusage program [arguments...]
+ *
+ * Runs the program in a child process, waits for it, and prints what
+ * getrusage(RUSAGE_CHILDREN) says about it: page faults by kind,
+ * copy-on-write copies, swap traffic, and its peak resident size.
+ * Anything the program itself forks and waits for is included.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+static
+void
+report(const char *what, unsigned long long count)
+{
+	printf("vmusage: %-28s %10llu\n", what, count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rusage ru;
+	int pid, status;
+
+	if (argc < 2) {
+		errx(1, "Usage: vmusage program [arguments...]");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv(argv[1], &argv[1]);
+		err(1, "%s", argv[1]);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (getrusage(RUSAGE_CHILDREN, &ru) < 0) {
+		err(1, "getrusage");
+	}
+
+	if (WIFSIGNALED(status)) {
+		printf("vmusage: %s: signal %d\n", argv[1], WTERMSIG(status));
+	}
+	else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		printf("vmusage: %s: exit %d\n", argv[1], WEXITSTATUS(status));
+	}
+	report("TLB misses", ru.ru_tlbfaults);
+	report("  reloaded from memory", ru.ru_reloads);
+	report("  zero-filled", ru.ru_zerofaults);
+	report("  read from file", ru.ru_filefaults);
+	report("  read from swap", ru.ru_swapfaults);
+	report("  from compressed store", ru.ru_zpoolfaults);
+	report("Copy-on-write copies", ru.ru_cowfaults);
+	report("Swap pages in", ru.ru_swapins);
+	report("Swap pages out", ru.ru_swapouts);
+	report("Peak resident size (kb)", ru.ru_maxrss);
+	return 0;
+}
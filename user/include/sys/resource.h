@@ -0,0 +1,20 @@
+#ifndef _SYS_RESOURCE_H_
+#define _SYS_RESOURCE_H_
+
+#include <sys/types.h>
+
+/*
+ * Get struct rusage and the RUSAGE_* constants from the kernel.
+ */
+#include <kern/time.h>
+#include <kern/resource.h>
+
+/*
+ * getrusage fills in USAGE for the calling process (RUSAGE_SELF) or
+ * for its children that have exited and been waited for
+ * (RUSAGE_CHILDREN). Only the virtual memory fields are kept; see
+ * <kern/resource.h>.
+ */
+int getrusage(int who, struct rusage *usage);
+
+#endif /* _SYS_RESOURCE_H_ */
@@ -0,0 +1,31 @@
+#ifndef _SYS_SHM_H_
+#define _SYS_SHM_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the IPC_* and SHM_* flags from the kernel.
+ */
+#include <kern/shm.h>
+
+/* Returned by shmat on error */
+#define SHM_FAILED ((void *)-1)
+
+struct shmid_ds;	/* not used; pass NULL */
+
+/*
+ * shmget returns the id of the shared memory segment with key KEY,
+ * creating one of SIZE bytes if FLAGS has IPC_CREAT and there is none
+ * (or always, with IPC_PRIVATE). shmat maps a segment into the
+ * address space at ADDR, or wherever there's room if ADDR is NULL,
+ * and returns where; shmdt unmaps it again. Mappings are inherited
+ * across fork. A segment goes away when the last process using it
+ * detaches, or on shmctl(id, IPC_RMID, NULL) if nobody has it
+ * attached.
+ */
+int shmget(key_t key, size_t size, int flags);
+void *shmat(int id, const void *addr, int flags);
+int shmdt(const void *addr);
+int shmctl(int id, int cmd, struct shmid_ds *buf);
+
+#endif /* _SYS_SHM_H_ */
@@ -0,0 +1,197 @@
+/*
+ * mergetest - check that same-page merging keeps each process's
+ * memory its own.
+ *
+ * Several children each fill an array with the same contents, plus
+ * some pages that are only ever read and so stay zero. They then
+ * wait long enough for the kernel to merge their pages, checking
+ * them as they go. Finally each writes its own contents over a
+ * different share of the pages, and checks that it sees its own
+ * writes and none of the others'.
+ *
+ * Turn merging on from the kernel menu ("merge on") before running
+ * this, and look at "merge" afterwards to see what was shared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <err.h>
+
+#define PAGESIZE	4096
+#define NPAGES		32
+#define NZERO		16
+#define PAGEWORDS	(PAGESIZE / sizeof(unsigned))
+#define NCHILDREN	4
+#define WAITSECS	12	/* a couple of merge scans */
+
+static unsigned pages[NPAGES][PAGEWORDS];
+static unsigned zeros[NZERO][PAGEWORDS];
+
+/*
+ * Page contents are a pseudo-random sequence started from a seed, so
+ * no two pages match unless they're meant to, and every word of a
+ * page has to be right for it to be merged. Page I starts out with
+ * seed I in every child; child N's own version of it has seed
+ * I + (N + 1) * NPAGES.
+ */
+static
+unsigned
+nextword(unsigned x)
+{
+	return x * 1103515245 + 12345;
+}
+
+static
+void
+setpage(unsigned *page, unsigned seed)
+{
+	unsigned j, x;
+
+	x = seed;
+	for (j=0; j<PAGEWORDS; j++) {
+		x = nextword(x);
+		page[j] = x;
+	}
+}
+
+/*
+ * Return the first word of PAGE that isn't as SEED makes it, or
+ * PAGEWORDS if it's all right.
+ */
+static
+unsigned
+badword(const unsigned *page, unsigned seed)
+{
+	unsigned j, x;
+
+	x = seed;
+	for (j=0; j<PAGEWORDS; j++) {
+		x = nextword(x);
+		if (page[j] != x) {
+			return j;
+		}
+	}
+	return PAGEWORDS;
+}
+
+/*
+ * Check that page I of child N holds seed SEED.
+ */
+static
+void
+checkpage(unsigned n, unsigned i, unsigned seed)
+{
+	unsigned j;
+
+	j = badword(pages[i], seed);
+	if (j < PAGEWORDS) {
+		errx(1, "child %u: page %u word %u: 0x%x, expected "
+		     "seed %u", n, i, j, pages[i][j], seed);
+	}
+}
+
+/*
+ * While the pages may be getting merged: everything is still as
+ * every child made it, and the zero pages are still zero.
+ */
+static
+void
+checkmerged(unsigned n)
+{
+	unsigned i, j;
+
+	for (i=0; i<NPAGES; i++) {
+		checkpage(n, i, i);
+	}
+	for (i=0; i<NZERO; i++) {
+		for (j=0; j<PAGEWORDS; j++) {
+			if (zeros[i][j] != 0) {
+				errx(1, "child %u: zero page %u word %u: "
+				     "0x%x", n, i, j, zeros[i][j]);
+			}
+		}
+	}
+}
+
+/*
+ * After the split: child N sees its own version of the pages it
+ * wrote, and every other page as before, whatever the other
+ * children, which may share them, have written.
+ */
+static
+void
+checksplit(unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<NPAGES; i++) {
+		if (i % NCHILDREN == n) {
+			checkpage(n, i, i + (n + 1) * NPAGES);
+		}
+		else {
+			checkpage(n, i, i);
+		}
+	}
+}
+
+static
+void
+child(unsigned n)
+{
+	time_t start;
+	unsigned i;
+
+	/* The same in every child; the zero pages are only read. */
+	for (i=0; i<NPAGES; i++) {
+		setpage(pages[i], i);
+	}
+	checkmerged(n);
+
+	start = time(NULL);
+	while (time(NULL) - start < WAITSECS) {
+		checkmerged(n);
+	}
+
+	/* Now split them again: each page is written by one child. */
+	for (i=n; i<NPAGES; i+=NCHILDREN) {
+		setpage(pages[i], i + (n + 1) * NPAGES);
+	}
+	checksplit(n);
+	exit(0);
+}
+
+int
+main(void)
+{
+	unsigned i;
+	int pids[NCHILDREN];
+	int status, failed;
+
+	for (i=0; i<NCHILDREN; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			child(i);
+		}
+	}
+
+	failed = 0;
+	for (i=0; i<NCHILDREN; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			/* The child has already complained. */
+			failed = 1;
+		}
+	}
+	if (failed) {
+		exit(1);
+	}
+	printf("mergetest: passed\n");
+	return 0;
+}
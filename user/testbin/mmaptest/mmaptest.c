@@ -0,0 +1,160 @@
+/*
+ * mmaptest - exercise anonymous mmap and munmap.
+ *
+ * Maps a private and a shared region, forks, and checks that the
+ * child's writes are seen by the parent only in the shared one. Then
+ * unmaps the middle of the private region, maps the hole again with
+ * MAP_FIXED, and checks that the pieces either side kept their
+ * contents and that the new mapping starts out zero. Finally checks
+ * that bad flags or protections are EINVAL, and a file mapping EBADF.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGESIZE	4096
+#define NPAGES		16
+#define PAGEWORDS	(PAGESIZE / sizeof(unsigned))
+
+/*
+ * Each page of a mapping is stamped with a tag in its first and last
+ * words, which is enough to tell whose write it sees. Fresh memory
+ * has to be zero throughout, so that's checked word by word.
+ */
+static
+void
+stamp(unsigned *mem, unsigned tag, unsigned first, unsigned npages)
+{
+	unsigned i;
+
+	for (i=first; i<first+npages; i++) {
+		mem[i*PAGEWORDS] = tag;
+		mem[i*PAGEWORDS + PAGEWORDS - 1] = tag;
+	}
+}
+
+static
+void
+expect(const char *what, unsigned *mem, unsigned tag,
+       unsigned first, unsigned npages)
+{
+	unsigned i;
+
+	for (i=first; i<first+npages; i++) {
+		if (mem[i*PAGEWORDS] != tag ||
+		    mem[i*PAGEWORDS + PAGEWORDS - 1] != tag) {
+			errx(1, "%s: page %u: 0x%x...0x%x, expected 0x%x",
+			     what, i, mem[i*PAGEWORDS],
+			     mem[i*PAGEWORDS + PAGEWORDS - 1], tag);
+		}
+	}
+}
+
+static
+void
+zeroed(const char *what, unsigned *mem, unsigned first, unsigned npages)
+{
+	unsigned i;
+
+	for (i=first*PAGEWORDS; i<(first+npages)*PAGEWORDS; i++) {
+		if (mem[i] != 0) {
+			errx(1, "%s: page %u word %u: 0x%x, expected 0",
+			     what, i / PAGEWORDS, i % PAGEWORDS, mem[i]);
+		}
+	}
+}
+
+static
+unsigned *
+map(int flags, void *addr)
+{
+	void *p;
+
+	p = mmap(addr, NPAGES * PAGESIZE, PROT_READ | PROT_WRITE,
+		 flags | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+static
+void
+badmap(int prot, int flags, int want)
+{
+	if (mmap(NULL, PAGESIZE, prot, flags, -1, 0) != MAP_FAILED) {
+		errx(1, "mmap with prot 0x%x flags 0x%x succeeded",
+		     prot, flags);
+	}
+	if (errno != want) {
+		errx(1, "mmap with prot 0x%x flags 0x%x: errno %d, "
+		     "expected %d", prot, flags, errno, want);
+	}
+}
+
+int
+main(void)
+{
+	unsigned *priv, *shared, *hole;
+	int pid, status;
+
+	priv = map(MAP_PRIVATE, NULL);
+	shared = map(MAP_SHARED, NULL);
+	zeroed("fresh private mapping", priv, 0, NPAGES);
+
+	/* Touch only half the shared pages before forking. */
+	stamp(priv, 1, 0, NPAGES);
+	stamp(shared, 1, 0, NPAGES / 2);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		stamp(priv, 2, 0, NPAGES);
+		stamp(shared, 2, 0, NPAGES);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+	expect("private mapping after fork", priv, 1, 0, NPAGES);
+	expect("shared mapping after fork", shared, 2, 0, NPAGES);
+	printf("mmaptest: fork ok\n");
+
+	/* Punch a hole in the middle, then fill it again. */
+	hole = priv + 4 * PAGEWORDS;
+	if (munmap(hole, 8 * PAGESIZE) < 0) {
+		err(1, "munmap");
+	}
+	expect("below the hole", priv, 1, 0, 4);
+	expect("above the hole", priv, 1, 12, 4);
+	if (mmap(hole, 8 * PAGESIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_FIXED | MAP_ANON, -1, 0) != hole) {
+		err(1, "mmap MAP_FIXED");
+	}
+	zeroed("remapped hole", priv, 4, 8);
+
+	if (munmap(priv, 4 * PAGESIZE) < 0 ||
+	    munmap(hole, 8 * PAGESIZE) < 0 ||
+	    munmap(priv + 12 * PAGEWORDS, 4 * PAGESIZE) < 0 ||
+	    munmap(shared, NPAGES * PAGESIZE) < 0) {
+		err(1, "munmap");
+	}
+
+	badmap(PROT_READ, MAP_PRIVATE | MAP_ANON | 0x100000, EINVAL);
+	badmap(PROT_READ, MAP_ANON, EINVAL);
+	badmap(PROT_READ, MAP_SHARED | MAP_PRIVATE | MAP_ANON, EINVAL);
+	badmap(PROT_READ | 0x100, MAP_PRIVATE | MAP_ANON, EINVAL);
+	badmap(PROT_READ, MAP_PRIVATE, EBADF);
+	printf("mmaptest: passed\n");
+	return 0;
+}
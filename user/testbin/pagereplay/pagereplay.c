@@ -0,0 +1,164 @@
+/*
+ * pagereplay - replay a fixed page access pattern, for comparing page
+ * replacement policies.
+ *
+ * Usage: pagereplay pattern [npages [naccesses]]
+ *
+ * Touches NACCESSES pages, chosen from an area of NPAGES pages by one
+ * of these patterns:
+ *
+ *    loop     - sweep through every page in order, over and over.
+ *    random   - pick pages uniformly at random.
+ *    zipf     - pick pages with a Zipf distribution: page i is used
+ *               in proportion to 1/(i+1).
+ *    scanhot  - alternate between a hot set of the first eighth of
+ *               the pages and a sequential scan through the rest.
+ *
+ * The random choices use a fixed seed, so each run of a pattern is
+ * the same. To compare policies, make NPAGES larger than physical
+ * memory, and from the kernel menu run for example
+ *
+ *    vmpolicy fifo; vs -z; p /testbin/pagereplay zipf; vs
+ *
+ * for each policy, and compare the fault counts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PAGESIZE	4096
+#define PAGEWORDS	(PAGESIZE / sizeof(unsigned))
+
+#define DEFAULT_NPAGES		1024
+#define DEFAULT_NACCESSES	20000
+
+static unsigned *area;
+static unsigned npages;
+
+/* Cumulative Zipf weights */
+static unsigned *zipfsum;
+
+static
+void
+zipf_init(void)
+{
+	unsigned i, total;
+
+	zipfsum = malloc(npages * sizeof(unsigned));
+	if (zipfsum == NULL) {
+		errx(1, "out of memory");
+	}
+	total = 0;
+	for (i=0; i<npages; i++) {
+		total += 1000000 / (i + 1);
+		zipfsum[i] = total;
+	}
+}
+
+static
+unsigned
+zipf_pick(void)
+{
+	unsigned lo, hi, mid, r;
+
+	r = random() % zipfsum[npages - 1];
+
+	/* The first page whose cumulative weight exceeds R */
+	lo = 0;
+	hi = npages - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (zipfsum[mid] > r) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Page to use for access number N.
+ */
+static
+unsigned
+pick(const char *pattern, unsigned n)
+{
+	unsigned hot;
+
+	if (!strcmp(pattern, "loop")) {
+		return n % npages;
+	}
+	if (!strcmp(pattern, "random")) {
+		return random() % npages;
+	}
+	if (!strcmp(pattern, "zipf")) {
+		return zipf_pick();
+	}
+	if (!strcmp(pattern, "scanhot")) {
+		hot = npages / 8;
+		if (n % 2 == 0) {
+			return random() % hot;
+		}
+		return hot + (n / 2) % (npages - hot);
+	}
+	errx(1, "unknown pattern %s", pattern);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *pattern;
+	unsigned naccesses, i, page, word;
+	void *mem;
+
+	if (argc < 2 || argc > 4) {
+		errx(1, "usage: pagereplay loop|random|zipf|scanhot "
+		     "[npages [naccesses]]");
+	}
+	pattern = argv[1];
+	npages = argc > 2 ? atoi(argv[2]) : DEFAULT_NPAGES;
+	naccesses = argc > 3 ? atoi(argv[3]) : DEFAULT_NACCESSES;
+	if (npages < 8) {
+		errx(1, "npages must be at least 8");
+	}
+
+	mem = sbrk(npages * PAGESIZE);
+	if (mem == (void *)-1) {
+		err(1, "sbrk");
+	}
+	area = mem;
+
+	srandom(161);
+	if (!strcmp(pattern, "zipf")) {
+		zipf_init();
+	}
+
+	/*
+	 * Each page holds its own number, written on first touch, so
+	 * pages that come back from swap wrong are caught.
+	 */
+	for (i=0; i<naccesses; i++) {
+		page = pick(pattern, i);
+		word = i % PAGEWORDS;
+		if (area[page * PAGEWORDS] == 0) {
+			area[page * PAGEWORDS] = page + 1;
+		}
+		else if (area[page * PAGEWORDS] != page + 1) {
+			errx(1, "page %u: found 0x%x, expected 0x%x", page,
+			     area[page * PAGEWORDS], page + 1);
+		}
+		if (word != 0) {
+			area[page * PAGEWORDS + word]++;
+		}
+	}
+
+	printf("pagereplay: %s, %u pages, %u accesses: done\n",
+	       pattern, npages, naccesses);
+	return 0;
+}
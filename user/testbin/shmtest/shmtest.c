@@ -0,0 +1,230 @@
+/*
+ * shmtest - check System V-style shared memory segments.
+ *
+ * A producer and a consumer, started by fork before either has the
+ * segment, find it by key and attach it separately; the producer
+ * fills it and the consumer checks what it sees. A second segment is
+ * attached before fork so the child inherits it, and then both write
+ * to it. Finally the key should be gone once everything is detached,
+ * and removing id 0 must fail rather than find some private segment.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <err.h>
+
+#define KEY		161
+#define NWORDS		(3 * 4096 / sizeof(unsigned))
+#define READY		0xfeedfaceU
+
+static
+unsigned
+pattern(unsigned i)
+{
+	return (i * 2654435761U) ^ 0x5a5a5a5a;
+}
+
+static
+void
+waitfor(int pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+/*
+ * Attach the segment with key KEY, creating it if CREATE.
+ */
+static
+volatile unsigned *
+attach(int create)
+{
+	volatile unsigned *p;
+	int id;
+
+	id = shmget(KEY, NWORDS * sizeof(unsigned), create ? IPC_CREAT : 0);
+	if (id < 0) {
+		err(1, "shmget");
+	}
+	p = shmat(id, NULL, 0);
+	if (p == SHM_FAILED) {
+		err(1, "shmat");
+	}
+	return p;
+}
+
+static
+void
+producer(void)
+{
+	volatile unsigned *p;
+	unsigned i;
+
+	p = attach(1);
+	for (i=1; i<NWORDS; i++) {
+		p[i] = pattern(i);
+	}
+	p[0] = READY;
+
+	/* Stay attached until the consumer has seen it. */
+	while (p[0] != 0) {
+		/* spin */
+	}
+	if (shmdt((const void *)p) < 0) {
+		err(1, "producer: shmdt");
+	}
+	exit(0);
+}
+
+static
+void
+consumer(void)
+{
+	volatile unsigned *p;
+	unsigned i;
+	int id;
+
+	/* Wait for the producer to make it. */
+	while ((id = shmget(KEY, 0, 0)) < 0) {
+		if (errno != ENOENT) {
+			err(1, "consumer: shmget");
+		}
+	}
+	p = shmat(id, NULL, 0);
+	if (p == SHM_FAILED) {
+		err(1, "consumer: shmat");
+	}
+	while (p[0] != READY) {
+		/* spin */
+	}
+	for (i=1; i<NWORDS; i++) {
+		if (p[i] != pattern(i)) {
+			errx(1, "consumer: word %u is 0x%x, expected 0x%x",
+			     i, p[i], pattern(i));
+		}
+	}
+	p[0] = 0;
+	if (shmdt((const void *)p) < 0) {
+		err(1, "consumer: shmdt");
+	}
+	exit(0);
+}
+
+static
+void
+inherit(void)
+{
+	volatile unsigned *p;
+	int id, pid;
+
+	id = shmget(IPC_PRIVATE, sizeof(unsigned) * 2, IPC_CREAT);
+	if (id < 0) {
+		err(1, "shmget private");
+	}
+	p = shmat(id, NULL, 0);
+	if (p == SHM_FAILED) {
+		err(1, "shmat private");
+	}
+	p[0] = 1;
+	p[1] = 0;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (p[0] != 1) {
+			errx(1, "child: inherited segment has 0x%x", p[0]);
+		}
+		p[1] = 2;
+		exit(0);
+	}
+	waitfor(pid);
+	if (p[1] != 2) {
+		errx(1, "parent: child's write not seen (0x%x)", p[1]);
+	}
+	if (shmdt((const void *)p) < 0) {
+		err(1, "shmdt private");
+	}
+	if (shmdt((const void *)p) == 0) {
+		errx(1, "shmdt of a detached segment succeeded");
+	}
+}
+
+/*
+ * Id 0 isn't a segment; removing it must not take out some private
+ * segment nobody is attached to.
+ */
+static
+void
+badremove(void)
+{
+	void *p;
+	int id;
+
+	id = shmget(IPC_PRIVATE, sizeof(unsigned), IPC_CREAT);
+	if (id < 0) {
+		err(1, "shmget private");
+	}
+	if (shmctl(0, IPC_RMID, NULL) == 0) {
+		errx(1, "shmctl(0, IPC_RMID) succeeded");
+	}
+	if (errno != EINVAL) {
+		err(1, "shmctl(0, IPC_RMID): expected EINVAL");
+	}
+	p = shmat(id, NULL, 0);
+	if (p == SHM_FAILED) {
+		err(1, "shmat private after shmctl(0, IPC_RMID)");
+	}
+	if (shmctl(id, IPC_RMID, NULL) < 0) {
+		err(1, "shmctl private");
+	}
+	if (shmdt(p) < 0) {
+		err(1, "shmdt private");
+	}
+}
+
+int
+main(void)
+{
+	int pid1, pid2;
+
+	pid1 = fork();
+	if (pid1 < 0) {
+		err(1, "fork");
+	}
+	if (pid1 == 0) {
+		consumer();
+	}
+	pid2 = fork();
+	if (pid2 < 0) {
+		err(1, "fork");
+	}
+	if (pid2 == 0) {
+		producer();
+	}
+	waitfor(pid1);
+	waitfor(pid2);
+
+	/* Both detached, so it should be gone. */
+	if (shmget(KEY, 0, 0) >= 0 || errno != ENOENT) {
+		errx(1, "segment still there after the last detach");
+	}
+
+	inherit();
+	badremove();
+
+	printf("shmtest: passed\n");
+	return 0;
+}